@@ -1,8 +1,19 @@
 #include "codegen/codegen.hh"
 
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+
 namespace Frontend
 {
-void Codegen::gen()
+void Codegen::init()
 {
     context = std::make_unique<LLVMContext>();
     module = std::make_unique<Module>(mod_name, *context);
@@ -10,39 +21,111 @@ void Codegen::gen()
     // Create a new builder for the module.
     builder = std::make_unique<IRBuilder<>>(*context);
 
+    if (opts.emit != CodegenOptions::Emit::BITCODE ||
+        opts.target_triple != nullptr || opts.mcpu != nullptr)
+        createTargetMachine();
+}
+
+// Code generator level matching -O<n>
+static CodeGenOpt::Level codegenLevel(unsigned opt_level)
+{
+    static const CodeGenOpt::Level levels[] =
+        {CodeGenOpt::None, CodeGenOpt::Less,
+         CodeGenOpt::Default, CodeGenOpt::Aggressive};
+    return levels[std::min(opt_level, 3u)];
+}
+
+void Codegen::createTargetMachine()
+{
+    InitializeAllTargetInfos();
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    InitializeAllAsmPrinters();
+
+    std::string triple = (opts.target_triple != nullptr) ?
+                         Triple::normalize(opts.target_triple) :
+                         sys::getDefaultTargetTriple();
+
+    std::string err;
+    const Target *target = TargetRegistry::lookupTarget(triple, err);
+    if (target == nullptr)
+    {
+        std::cerr << "[Error] " << triple << ": " << err << "\n";
+        exit(1);
+    }
+
+    std::string cpu = (opts.mcpu == nullptr) ? "generic" : opts.mcpu;
+    if (cpu == "native") cpu = sys::getHostCPUName().str();
+
+    // PIC, so that the object links into the default (PIE) executable
+    target_machine.reset(target->createTargetMachine(
+        triple, cpu, "", TargetOptions(), Reloc::PIC_, None,
+        codegenLevel(opts.opt_level)));
+    if (target_machine == nullptr)
+    {
+        std::cerr << "[Error] cannot generate code for " << triple
+                  << " (" << cpu << ")\n";
+        exit(1);
+    }
+
+    // The optimizer and the code generator must agree on these
+    module->setTargetTriple(triple);
+    module->setDataLayout(target_machine->createDataLayout());
+}
+
+void Codegen::gen()
+{
+    init();
+
     // Codegen begins
     auto &program = parser->getProgram();
     auto &statements = program.getStatements();
 
+    // Declare every function first, a call may come before the callee's
+    // definition (see ParseOptions)
     for (auto &statement : statements)
     {
         assert(statement->isStatementFunc());
-        funcGen(statement.get());
+        funcDeclGen(statement);
+    }
+
+    for (auto &statement : statements)
+    {
+        funcGen(statement);
 
     }
 }
 
-void Codegen::funcGen(Statement *_statement)
+void Codegen::genFunction(Parser *_parser, Statement *_statement)
+{
+    // A callee parsed after its caller was declared by the call
+    parser = _parser;
+    funcDeclGen(_statement);
+    funcGen(_statement);
+}
+
+void Codegen::funcDeclGen(Statement *_statement)
 {
     FuncStatement *func_statement = 
         static_cast<FuncStatement*>(_statement);
 
-    // We need to extract the local variables reference
-    local_vars_ref.push_back(func_statement->getLocalVars());
-    local_vars_tracker.emplace_back();
+    funcDecl(func_statement->getFuncSymbol(),
+             func_statement->getFuncName());
+}
 
-    auto& func_name = func_statement->getFuncName();
-    auto& func_args = func_statement->getFuncArgs();
-    auto& func_codes = func_statement->getFuncCodes();
+// Declares function sym from its signature, unless it already is
+Function *Codegen::funcDecl(Symbol sym, StringRef func_name)
+{
+    if (Function *func = module->getFunction(func_name)) return func;
 
     // IR Gen
     // Prepare argument types
     std::vector<Type *> ir_gen_func_args;
-    for (auto &arg : func_args)
+    for (auto arg_type : parser->getFuncArgTypes(sym))
     {
-        if (arg.getArgType() == ValueType::Type::INT)
+        if (arg_type == ValueType::Type::INT)
             ir_gen_func_args.push_back(Type::getInt32Ty(*context));
-        else if (arg.getArgType() == ValueType::Type::FLOAT)
+        else if (arg_type == ValueType::Type::FLOAT)
             ir_gen_func_args.push_back(Type::getFloatTy(*context));
         else
             assert(false && 
@@ -50,12 +133,13 @@ void Codegen::funcGen(Statement *_statement)
     }
 
     // Prepare return type
+    auto ret_type = parser->getFuncRetType(sym);
     Type *ir_gen_ret_type;
-    if (func_statement->getRetType() == ValueType::Type::VOID)
+    if (ret_type == ValueType::Type::VOID)
         ir_gen_ret_type = Type::getVoidTy(*context);
-    else if (func_statement->getRetType() == ValueType::Type::INT)
+    else if (ret_type == ValueType::Type::INT)
         ir_gen_ret_type = Type::getInt32Ty(*context);
-    else if (func_statement->getRetType() == ValueType::Type::FLOAT)
+    else if (ret_type == ValueType::Type::FLOAT)
         ir_gen_ret_type = Type::getFloatTy(*context);
     else
         assert(false && 
@@ -70,45 +154,80 @@ void Codegen::funcGen(Statement *_statement)
     GlobalValue::LinkageTypes link_type = Function::ExternalLinkage;
 
     // Create function declaration
-    Function *ir_gen_func = Function::Create(ir_gen_func_type,
-                                             link_type, 
-                                             func_name, 
-                                             module.get());
+    Function *func = Function::Create(ir_gen_func_type, link_type,
+                                      func_name, module.get());
+
+    // Keeps --mcpu in the bitcode, for llc and the like
+    if (target_machine != nullptr)
+        func->addFnAttr("target-cpu", target_machine->getTargetCPU());
+    return func;
+}
+
+void Codegen::funcGen(Statement *_statement)
+{
+    FuncStatement *func_statement = 
+        static_cast<FuncStatement*>(_statement);
+
+    // We need to extract the local variables reference
+    enterBlock(func_statement->getLocalVars());
+
+    auto& func_args = func_statement->getFuncArgs();
+    auto& func_codes = func_statement->getFuncCodes();
+
+    Function *ir_gen_func =
+        module->getFunction(func_statement->getFuncName());
    
     // Create a new basic block to start insertion into.
     BasicBlock *BB = BasicBlock::Create(*context, "", ir_gen_func);
     builder->SetInsertPoint(BB);
+    last_alloca = nullptr;
+
+    ssa_var_types.clear();
+    current_defs.clear();
+    incomplete_phis.clear();
+    sealed_blocks.clear();
+    sealBlock(BB);
 
     // Generate the code section
     // (1) Allocate space for arguments
     auto i = 0;
     std::vector<ValueType::Type> func_arg_types;
     if (ir_gen_func->arg_size())
-        func_arg_types = parser->getFuncArgTypes(func_name);
+        func_arg_types = 
+            parser->getFuncArgTypes(func_statement->getFuncSymbol());
     for (auto &arg : ir_gen_func->args())
     {
         Value *val = &arg;
         Value *reg;
 
+        if (opts.ssa)
+        {
+            auto var = declareSsaVar(func_args[i].getSymbol(),
+                                     func_arg_types[i]);
+            writeVariable(var, BB, val);
+            i++;
+            continue;
+        }
+
         if (func_arg_types[i] == ValueType::Type::INT)
         {
-            reg = builder->CreateAlloca(Type::getInt32Ty(*context));
+            reg = createEntryAlloca(Type::getInt32Ty(*context));
             builder->CreateStore(val, reg);
 	}
         else if (func_arg_types[i] == ValueType::Type::FLOAT)
         {
-            reg = builder->CreateAlloca(Type::getFloatTy(*context));
+            reg = createEntryAlloca(Type::getFloatTy(*context));
             builder->CreateStore(val, reg);
 	}
 
-        recordLocalVar(func_args[i].getLiteral(), reg);
+        recordLocalVar(func_args[i].getSymbol(), reg);
         i++;
     }
 
     // (2) Rest of the codes
     for (auto &statement : func_codes)
     {
-        statementGen(func_name, statement.get());
+        statementGen(func_statement->getFuncSymbol(), statement);
     }
 
     if (func_statement->getRetType() == ValueType::Type::VOID)
@@ -117,14 +236,161 @@ void Codegen::funcGen(Statement *_statement)
         builder->CreateRet(val);
     }
 
+    // Every block has been sealed
+    assert(incomplete_phis.empty());
+
     // Verify function
     verifyFunction(*ir_gen_func);
 
-    local_vars_tracker.pop_back();
-    local_vars_ref.pop_back();
+    exitBlock();
+}
+
+Value *Codegen::createEntryAlloca(Type *type)
+{
+    BasicBlock &entry =
+        builder->GetInsertBlock()->getParent()->getEntryBlock();
+
+    IRBuilder<> entry_builder(*context);
+    if (last_alloca != nullptr)
+        entry_builder.SetInsertPoint(&entry,
+                                     ++last_alloca->getIterator());
+    else
+        entry_builder.SetInsertPoint(&entry, entry.begin());
+
+    last_alloca = entry_builder.CreateAlloca(type);
+    return last_alloca;
+}
+
+unsigned Codegen::declareSsaVar(Symbol var_sym, ValueType::Type type)
+{
+    auto var = local_vars.find(var_sym);
+    assert(var != nullptr);
+
+    var->ssa_var = ssa_var_types.size();
+    if (type == ValueType::Type::INT)
+        ssa_var_types.push_back(Type::getInt32Ty(*context));
+    else if (type == ValueType::Type::FLOAT)
+        ssa_var_types.push_back(Type::getFloatTy(*context));
+    else
+        assert(false &&
+               "[Error] declareSsaVar: unsupported variable type. \n");
+
+    return var->ssa_var;
+}
+
+Value *Codegen::readVariable(unsigned var, BasicBlock *BB)
+{
+    auto iter = current_defs.find(std::make_pair(BB, var));
+    if (iter != current_defs.end()) return iter->second;
+
+    return readVariableRecursive(var, BB);
+}
+
+Value *Codegen::readVariableRecursive(unsigned var, BasicBlock *BB)
+{
+    Value *val;
+    if (!sealed_blocks.count(BB))
+    {
+        // More predecessors to come, sealBlock() fills the phi in
+        PHINode *phi = createPhi(var, BB);
+        incomplete_phis[BB].push_back(std::make_pair(var, phi));
+        val = phi;
+    }
+    else if (BasicBlock *pred = BB->getUniquePredecessor())
+    {
+        // Nothing to merge
+        val = readVariable(var, pred);
+    }
+    else if (pred_empty(BB))
+    {
+        // Read before any assignment
+        val = UndefValue::get(ssa_var_types[var]);
+    }
+    else
+    {
+        // Record the phi before looking at the predecessors, a loop
+        // leads back here
+        PHINode *phi = createPhi(var, BB);
+        writeVariable(var, BB, phi);
+        val = addPhiOperands(var, phi);
+    }
+
+    writeVariable(var, BB, val);
+    return val;
+}
+
+PHINode *Codegen::createPhi(unsigned var, BasicBlock *BB)
+{
+    // Phis lead the block, the builder keeps appending behind them
+    Type *type = ssa_var_types[var];
+    if (BB->empty())
+        return PHINode::Create(type, 2, "", BB);
+    return PHINode::Create(type, 2, "", &BB->front());
+}
+
+Value *Codegen::addPhiOperands(unsigned var, PHINode *phi)
+{
+    // One incoming value per edge, as the verifier wants
+    BasicBlock *BB = phi->getParent();
+    for (BasicBlock *pred : predecessors(BB))
+        phi->addIncoming(readVariable(var, pred), pred);
+
+    return tryRemoveTrivialPhi(phi);
+}
+
+Value *Codegen::tryRemoveTrivialPhi(PHINode *phi)
+{
+    Value *same = nullptr;
+    for (Value *op : phi->incoming_values())
+    {
+        // Unique value or self-reference
+        if (op == same || op == phi) continue;
+        // The phi merges at least two values
+        if (same != nullptr) return phi;
+        same = op;
+    }
+
+    // Unreachable, or only reached by itself
+    if (same == nullptr) same = UndefValue::get(phi->getType());
+
+    // Phis using this one may turn trivial once it is gone; track them
+    // (and same, which may be one of them) across the removals below
+    SmallVector<WeakTrackingVH, 8> users;
+    for (User *user : phi->users())
+    {
+        if (user != phi && isa<PHINode>(user)) users.push_back(user);
+    }
+
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+
+    WeakTrackingVH result = same;
+    for (auto &user : users)
+    {
+        if (auto user_phi = dyn_cast_or_null<PHINode>(user))
+            tryRemoveTrivialPhi(user_phi);
+    }
+
+    return result;
 }
 
-void Codegen::statementGen(std::string &func_name,
+void Codegen::sealBlock(BasicBlock *BB)
+{
+    if (!opts.ssa) return;
+
+    auto iter = incomplete_phis.find(BB);
+    if (iter != incomplete_phis.end())
+    {
+        auto phis = std::move(iter->second);
+        incomplete_phis.erase(iter);
+
+        for (auto [var, phi] : phis) addPhiOperands(var, phi);
+    }
+
+    sealed_blocks.insert(BB);
+}
+
+void Codegen::statementGen(Symbol func_name,
                            Statement* statement)
 {
     if (statement->isStatementAssn())
@@ -162,7 +428,7 @@ void Codegen::assnGen(Statement *_statement)
     auto expr = assn_statement->getExpr();
 
     // Allocate for identifier
-    std::string var_name;
+    std::string_view var_name;
     ValueType::Type var_type;
     Value *reg;
 
@@ -180,6 +446,13 @@ void Codegen::assnGen(Statement *_statement)
     {
         arrayExprGen(var_type, reg, array_info);
     }
+    else if (reg == nullptr)
+    {
+        // A scalar in SSA form
+        auto var_sym = static_cast<LiteralExpression*>(iden)->getSymbol();
+        val = exprGen(var_type, expr);
+        writeVariable(getSsaVar(var_sym), builder->GetInsertBlock(), val);
+    }
     else
     {
         val = exprGen(var_type, expr);
@@ -187,7 +460,7 @@ void Codegen::assnGen(Statement *_statement)
     }
 }
 
-Value* Codegen::allocaForIden(std::string &var_name, 
+Value* Codegen::allocaForIden(std::string_view &var_name, 
                               ValueType::Type &var_type,
                               Expression* iden,
                               ArrayExpression* array_info)
@@ -195,24 +468,37 @@ Value* Codegen::allocaForIden(std::string &var_name,
     // We need to make sure the variable has not been allocated before
 
     // Determine identifier type
+    Symbol var_sym = StringInterner::INVALID_SYMBOL;
     if (iden->isExprLiteral())
     {
         LiteralExpression *lit = 
             static_cast<LiteralExpression*>(iden);
 
         var_name = lit->getLiteral();
-        var_type = getValType(var_name);
+        var_sym = lit->getSymbol();
+        var_type = getValType(var_sym);
     }
     else if (iden->isExprIndex())
     {
         IndexExpression *index = static_cast<IndexExpression*>(iden);
 	
         var_name = index->getIden();
-        var_type = getValType(var_name);
+        var_sym = index->getIdenSymbol();
+        var_type = getValType(var_sym);
+    }
+
+    // Scalars in SSA form have no memory, assnGen() writes their value
+    if (opts.ssa && iden->isExprLiteral() &&
+        (var_type == ValueType::Type::INT ||
+         var_type == ValueType::Type::FLOAT))
+    {
+        if (getSsaVar(var_sym) == NO_SSA_VAR)
+            declareSsaVar(var_sym, var_type);
+        return nullptr;
     }
 
     Value *reg;
-    if (auto [is_allocated, reg_base] = getReg(var_name);
+    if (auto [is_allocated, reg_base] = getReg(var_sym);
             !is_allocated)
     {
         // Allocating new variables, must be a literal iden
@@ -222,11 +508,11 @@ Value* Codegen::allocaForIden(std::string &var_name,
 
         if (var_type == ValueType::Type::INT)
         {
-            reg = builder->CreateAlloca(Type::getInt32Ty(*context));
+            reg = createEntryAlloca(Type::getInt32Ty(*context));
         }
         else if (var_type == ValueType::Type::FLOAT)
         {
-            reg = builder->CreateAlloca(Type::getFloatTy(*context));
+            reg = createEntryAlloca(Type::getFloatTy(*context));
         }
         else if (var_type == ValueType::Type::INT_ARRAY || 
                  var_type == ValueType::Type::FLOAT_ARRAY)
@@ -241,7 +527,7 @@ Value* Codegen::allocaForIden(std::string &var_name,
                 static_cast<LiteralExpression*>(num_ele_expr);
             assert(num_ele_lit->isLiteralInt());
     
-            auto num_ele_int = stoi(num_ele_lit->getLiteral());
+            auto num_ele_int = num_ele_lit->getIntValue();
 
             // Get array type
             Type *ele_type = (var_type == ValueType::Type::INT_ARRAY) ?
@@ -250,16 +536,16 @@ Value* Codegen::allocaForIden(std::string &var_name,
 
             ArrayType* array_type = ArrayType::get(ele_type, num_ele_int);
 
-            reg = builder->CreateAlloca(array_type);
+            reg = createEntryAlloca(array_type);
         }
         else
         {
 	    std::cerr << "[Error] unsupported allocation type for "
                       << var_name << "\n";
-            exit(0);
+            exit(1);
         }
 
-        recordLocalVar(var_name, reg);
+        recordLocalVar(var_sym, reg);
     }
     else
     {
@@ -270,7 +556,8 @@ Value* Codegen::allocaForIden(std::string &var_name,
             std::vector<Value*> idxs;
             idxs.push_back(ConstantInt::get(*context, APInt(32, 0)));
             idxs.push_back(idx);
-            reg = builder->CreateInBoundsGEP(reg_base, idxs);
+            reg = builder->CreateInBoundsGEP(
+                cast<AllocaInst>(reg_base)->getAllocatedType(), reg_base, idxs);
         }
         else if (iden->isExprLiteral())
         {
@@ -304,10 +591,10 @@ void Codegen::builtinGen(Statement *_statement)
     auto call_expr = built_in_statement->getCallExpr();
     assert(call_expr->isExprCall());
 
-    auto &func_name = call_expr->getCallFunc();
+    auto func_name = call_expr->getCallFunc();
     auto &func_args = call_expr->getArgs();
     assert(func_args.size() == 1);
-    auto expr = func_args[0].get();
+    auto expr = func_args[0];
 
     ValueType::Type var_type = (func_name == "printVarInt") ? 
         ValueType::Type::INT : ValueType::Type::FLOAT;
@@ -335,7 +622,7 @@ void Codegen::callGen(Statement *_statement)
     callExprGen(call_expr);
 }
 
-void Codegen::retGen(std::string &cur_func_name,
+void Codegen::retGen(Symbol cur_func_name,
                      Statement *_statement)
 {
     RetStatement* ret = static_cast<RetStatement*>(_statement);
@@ -428,7 +715,7 @@ Value* Codegen::condGen(Condition *cond)
     return eval;
 }
 
-void Codegen::ifGen(std::string& parent_func_name, Statement *_statement)
+void Codegen::ifGen(Symbol parent_func_name, Statement *_statement)
 {
     IfStatement *if_s = 
         static_cast<IfStatement*>(_statement);
@@ -456,44 +743,42 @@ void Codegen::ifGen(std::string& parent_func_name, Statement *_statement)
     {
         builder->CreateCondBr(cond, taken_BB, merge_BB);
     }
+    sealBlock(taken_BB);
+    if (not_taken_BB != nullptr) sealBlock(not_taken_BB);
 
     // Build the taken path
     builder->SetInsertPoint(taken_BB);
-    local_vars_ref.push_back(if_s->getTakenBlockVars());
-    local_vars_tracker.emplace_back();
+    enterBlock(if_s->getTakenBlockVars());
     for (auto &statement : taken_block)
     {
-        statementGen(parent_func_name, statement.get());
+        statementGen(parent_func_name, statement);
     }
     builder->CreateBr(merge_BB);
-    local_vars_ref.pop_back();
-    local_vars_tracker.pop_back();
+    exitBlock();
 
     // Build the not
     if (not_taken_BB != nullptr)
     {
         builder->SetInsertPoint(not_taken_BB);
-        local_vars_ref.push_back(if_s->getNotTakenBlockVars());
-        local_vars_tracker.emplace_back();
+        enterBlock(if_s->getNotTakenBlockVars());
         for (auto &statement : not_taken_block)
         {
-            statementGen(parent_func_name, statement.get());
+            statementGen(parent_func_name, statement);
         }
         builder->CreateBr(merge_BB);
-        local_vars_ref.pop_back();
-        local_vars_tracker.pop_back();
+        exitBlock();
     }
 
     builder->SetInsertPoint(merge_BB);
+    sealBlock(merge_BB);
 }
 
-void Codegen::forGen(std::string& parent_func_name, Statement *_statement)
+void Codegen::forGen(Symbol parent_func_name, Statement *_statement)
 {
     ForStatement *for_s = 
         static_cast<ForStatement*>(_statement);
 
-    local_vars_ref.push_back(for_s->getBlockVars());
-    local_vars_tracker.emplace_back();
+    enterBlock(for_s->getBlockVars());
 
     // Gen start
     assnGen(for_s->getStart());
@@ -516,24 +801,28 @@ void Codegen::forGen(std::string& parent_func_name, Statement *_statement)
 
     auto end_cond = condGen(for_s->getEnd());
     builder->CreateCondBr(end_cond, body_BB, merge_BB);
-    
+    sealBlock(body_BB);
+    sealBlock(merge_BB);
+
     // Gen boday
     builder->SetInsertPoint(body_BB);
     auto block = for_s->getBlock();
     for (auto code : block)
     {
-        statementGen(parent_func_name, code.get());
+        statementGen(parent_func_name, code);
     }
 
     // Gen step
     assnGen(for_s->getStep());
     builder->CreateBr(check_BB);
 
+    // The back edge was the last one
+    sealBlock(check_BB);
+
     // Loop end
     builder->SetInsertPoint(merge_BB);
 
-    local_vars_ref.pop_back();
-    local_vars_tracker.pop_back();
+    exitBlock();
 }
 
 Value* Codegen::exprGen(ValueType::Type _var_type, Expression *expr)
@@ -578,21 +867,31 @@ Value* Codegen::literalExprGen(ValueType::Type type,
                                LiteralExpression* lit)
 {
     Value *val;
-    auto [is_allocated, reg_val] = getReg(lit->getLiteral());
+    std::pair<bool,Value*> var = std::make_pair(false, nullptr);
+    if (lit->isLiteralIden())
+    {
+        auto ssa_var = getSsaVar(lit->getSymbol());
+        if (ssa_var != NO_SSA_VAR)
+            return readVariable(ssa_var, builder->GetInsertBlock());
+
+        var = getReg(lit->getSymbol());
+    }
+    auto [is_allocated, reg_val] = var;
 
     if (!is_allocated)
     {
         assert((lit->isLiteralInt() || 
                 lit->isLiteralFloat()));
 
-        auto val_str = lit->getLiteral();
         if (lit->isLiteralInt())
         {
-            val = ConstantInt::get(*context, APInt(32, stoi(val_str)));
+            val = ConstantInt::get(*context, 
+                                   APInt(32, lit->getIntValue()));
         }
         else if (lit->isLiteralFloat())
         {
-            val = ConstantFP::get(*context, APFloat(stof(val_str)));
+            val = ConstantFP::get(*context, 
+                                  APFloat(lit->getFloatValue()));
         }
     }
     else
@@ -634,19 +933,21 @@ void Codegen::arrayExprGen(ValueType::Type array_type,
     std::vector<Value *> index;
     index.push_back(ConstantInt::get(*context, APInt(32, 0)));
     index.push_back(ConstantInt::get(*context, APInt(32, 0)));
-    auto base = builder->CreateInBoundsGEP(reg, index);
+    Type *array_ir_type = cast<AllocaInst>(reg)->getAllocatedType();
+    auto base = builder->CreateInBoundsGEP(array_ir_type, reg, index);
 
     auto cnt = 0;
     auto last_ele_idx = array_info->getElements().size() - 1;
     auto const_one = ConstantInt::get(*context, APInt(32, 1));
     for (auto ele : array_info->getElements())
     {
-        Value *val = exprGen(type, ele.get());
+        Value *val = exprGen(type, ele);
         builder->CreateStore(val, base);
         if (++cnt <= last_ele_idx)
         {
             // increment one to the base
-            base = builder->CreateInBoundsGEP(base, const_one); 
+            base = builder->CreateInBoundsGEP(
+                array_ir_type->getArrayElementType(), base, const_one); 
         }
     }
 }
@@ -740,7 +1041,7 @@ Value* Codegen::arithExprGen(ValueType::Type type,
 Value* Codegen::indexExprGen(ValueType::Type type, 
                              IndexExpression* index)
 {
-    auto [is_allocated, reg_val] = getReg(index->getIden());
+    auto [is_allocated, reg_val] = getReg(index->getIdenSymbol());
     assert(is_allocated);
 
     Value *idx = exprGen(ValueType::Type::INT, index->getIndex());
@@ -748,7 +1049,8 @@ Value* Codegen::indexExprGen(ValueType::Type type,
     std::vector<Value*> idxs;
     idxs.push_back(ConstantInt::get(*context, APInt(32, 0)));
     idxs.push_back(idx);
-    auto base = builder->CreateInBoundsGEP(reg_val, idxs);
+    auto base = builder->CreateInBoundsGEP(
+        cast<AllocaInst>(reg_val)->getAllocatedType(), reg_val, idxs);
 
     Value *val;
     if (type == ValueType::Type::INT)
@@ -761,23 +1063,19 @@ Value* Codegen::indexExprGen(ValueType::Type type,
 
 Value* Codegen::callExprGen(CallExpression *call)
 {
-    auto &def = call->getCallFunc();
-    Function *call_func = module->getFunction(def);
-    if (!call_func)
-    {
-        std::cerr << "[Error] Please define function before CALL\n";
-        exit(0);
-    }
+    // Pipelined, the callee may not have been lowered yet
+    Function *call_func = funcDecl(call->getCallFuncSymbol(),
+                                   call->getCallFunc());
 
     auto args = call->getArgs();
-    auto arg_types = parser->getFuncArgTypes(def);
+    auto arg_types = parser->getFuncArgTypes(call->getCallFuncSymbol());
     assert(args.size() == call_func->arg_size());
     assert(arg_types.size() == call_func->arg_size());
 
     std::vector<Value*> call_func_args;
     for (auto i = 0; i < call_func->arg_size(); i++)
     {
-        auto expr = args[i].get();
+        auto expr = args[i];
 
         Value *val = exprGen(arg_types[i], expr);
         call_func_args.push_back(val);
@@ -786,11 +1084,158 @@ Value* Codegen::callExprGen(CallExpression *call)
     return builder->CreateCall(call_func, call_func_args);
 }
 
+void Codegen::optimize()
+{
+    if (opts.opt_level == 0) return;
+
+    static const OptimizationLevel levels[] =
+        {OptimizationLevel::O1, OptimizationLevel::O2, OptimizationLevel::O3};
+    if (opts.opt_level > 3)
+    {
+        std::cerr << "[Error] optimize: unsupported level -O"
+                  << opts.opt_level << "\n";
+        exit(1);
+    }
+
+    // Reported when timer goes out of scope
+    PassInstrumentationCallbacks PIC;
+    TimePassesHandler timer(opts.time_passes);
+    timer.setOutStream(errs());
+    timer.registerCallbacks(PIC);
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassBuilder PB(target_machine.get(), PipelineTuningOptions(), None,
+                   &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM =
+        PB.buildPerModuleDefaultPipeline(levels[opts.opt_level - 1]);
+    MPM.run(*module, MAM);
+}
+
 void Codegen::print()
 {
+    if (opts.emit != CodegenOptions::Emit::BITCODE)
+    {
+        emitNative();
+        return;
+    }
+
     // module->print(errs(), nullptr);
     std::error_code EC;
     raw_fd_ostream out(out_fn, EC);
     WriteBitcodeToFile(*module, out);
 }
+
+// Lowers the module in memory, no bitcode/llc round trip
+void Codegen::emitNative()
+{
+    assert(target_machine != nullptr);
+
+    std::error_code EC;
+    raw_fd_ostream out(out_fn, EC, sys::fs::OF_None);
+    if (EC)
+    {
+        std::cerr << "[Error] " << out_fn << ": " << EC.message() << "\n";
+        exit(1);
+    }
+
+    auto file_type = (opts.emit == CodegenOptions::Emit::ASSEMBLY) ?
+                     CGFT_AssemblyFile : CGFT_ObjectFile;
+
+    legacy::PassManager PM;
+    if (target_machine->addPassesToEmitFile(PM, out, nullptr, file_type))
+    {
+        std::cerr << "[Error] " << module->getTargetTriple()
+                  << " cannot emit this file type\n";
+        exit(1);
+    }
+    PM.run(*module);
+    out.flush();
+}
+
+// Builtins of JIT-compiled programs, same as util/print.c
+static void jitPrintVarInt(int x)
+{
+    printf("%d\n", x);
+}
+
+static void jitPrintVarFloat(float x)
+{
+    printf("%f\n", x);
+}
+
+static void exitOnJitError(Error err)
+{
+    if (!err) return;
+    std::cerr << "[Error] run: " << toString(std::move(err)) << "\n";
+    exit(1);
+}
+
+int Codegen::run()
+{
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    Function *main_func = module->getFunction("main");
+    if (main_func == nullptr || main_func->isDeclaration())
+    {
+        std::cerr << "[Error] run: no main function\n";
+        exit(1);
+    }
+    bool returns_int = main_func->getReturnType()->isIntegerTy(32);
+
+    auto jtmb = orc::JITTargetMachineBuilder::detectHost();
+    if (!jtmb) exitOnJitError(jtmb.takeError());
+    jtmb->setCodeGenOptLevel(codegenLevel(opts.opt_level));
+
+    auto jit = orc::LLJITBuilder()
+                   .setJITTargetMachineBuilder(std::move(*jtmb))
+                   .create();
+    if (!jit) exitOnJitError(jit.takeError());
+
+    // printVarInt/printVarFloat resolve to this process, no print.bc
+    auto &ES = (*jit)->getExecutionSession();
+    orc::MangleAndInterner mangle(ES, (*jit)->getDataLayout());
+    orc::SymbolMap builtins;
+    builtins[mangle("printVarInt")] = JITEvaluatedSymbol(
+        pointerToJITTargetAddress(&jitPrintVarInt),
+        JITSymbolFlags::Exported);
+    builtins[mangle("printVarFloat")] = JITEvaluatedSymbol(
+        pointerToJITTargetAddress(&jitPrintVarFloat),
+        JITSymbolFlags::Exported);
+    exitOnJitError(
+        (*jit)->getMainJITDylib().define(orc::absoluteSymbols(builtins)));
+
+    exitOnJitError((*jit)->addIRModule(
+        orc::ThreadSafeModule(std::move(module), std::move(context))));
+
+    auto main_sym = (*jit)->lookup("main");
+    if (!main_sym) exitOnJitError(main_sym.takeError());
+
+    int ret = 0;
+    if (returns_int)
+    {
+        auto main_ptr =
+            jitTargetAddressToFunction<int (*)()>(main_sym->getAddress());
+        ret = main_ptr();
+    }
+    else
+    {
+        auto main_ptr =
+            jitTargetAddressToFunction<void (*)()>(main_sym->getAddress());
+        main_ptr();
+    }
+
+    fflush(stdout);
+    return ret;
+}
 }
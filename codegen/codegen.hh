@@ -5,7 +5,9 @@
 
 // LLVM IR codegen libraries
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -14,13 +16,42 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Target/TargetMachine.h"
 
 using namespace llvm;
 
 namespace Frontend
 {
+struct CodegenOptions
+{
+    // What print() writes to the output file
+    enum class Emit
+    {
+        BITCODE,
+        // native code for target_triple, made in process
+        OBJECT,
+        ASSEMBLY
+    };
+    Emit emit = Emit::BITCODE;
+    // Target to generate code for, the host's if nullptr; mcpu nullptr
+    // is the generic CPU of the target, "native" the host's CPU. Either
+    // one also sets the triple, data layout and CPU of bitcode output.
+    const char *target_triple = nullptr;
+    const char *mcpu = nullptr;
+
+    // 0-3, the standard new pass manager pipeline of that level runs on
+    // the module before it is written; 0 runs nothing
+    unsigned opt_level = 0;
+    // Print the time spent in every pass to stderr
+    bool time_passes = false;
+    // Keep scalar variables in SSA values built during codegen instead
+    // of allocas for mem2reg to promote (arrays stay in memory)
+    bool ssa = false;
+};
+
 class Codegen
 {
   protected:
@@ -33,12 +64,20 @@ class Codegen
 
     Parser* parser;
 
+    CodegenOptions opts;
+
+    // Set up by init() when emitting native code or given a target,
+    // the module then carries its triple and data layout
+    std::unique_ptr<TargetMachine> target_machine;
+
   public:
 
     Codegen(const char* _mod_name,
-            const char* _out_fn)
+            const char* _out_fn,
+            const CodegenOptions &_opts = CodegenOptions())
         : mod_name(_mod_name)
         , out_fn(_out_fn)
+        , opts(_opts)
     {}
 
     void setParser(Parser *_parser)
@@ -48,65 +87,142 @@ class Codegen
 
     void gen();
 
+    // Pipelined mode (see ParseOptions::on_function): init() once, then
+    // genFunction() for every function as soon as it is parsed, instead
+    // of gen() on the whole program
+    void init();
+    void genFunction(Parser *_parser, Statement *_statement);
+
+    // Runs the pipeline of opts.opt_level on the module
+    void optimize();
+
+    // Writes the module to out_fn as bitcode, an object file or
+    // assembly (opts.emit)
     void print();
 
+    // Compiles the module in memory with an ORC LLJIT and calls its
+    // main, returning what main returns (0 if it returns nothing); the
+    // builtins are the driver's own. The module is handed over to the
+    // JIT, print() cannot be used afterwards.
+    int run();
+
   protected:
-    std::vector<std::unordered_map<std::string,
-                                   ValueType::Type>*> local_vars_ref;
-    std::vector<std::unordered_map<std::string,Value*>> local_vars_tracker;
+    void createTargetMachine();
+    void emitNative();
 
-    void recordLocalVar(std::string& var_name, Value* reg)
+    static constexpr unsigned NO_SSA_VAR = UINT_MAX;
+
+    // A variable in scope: its type from the AST and, once it has been
+    // allocated, its register (or, with opts.ssa, its SSA variable)
+    struct LocalVar
+    {
+        ValueType::Type type;
+        Value *reg = nullptr;
+        unsigned ssa_var = NO_SSA_VAR;
+    };
+    ScopedTable<LocalVar> local_vars;
+
+    // Opens the scope of a block, every variable the block declares is
+    // visible (but not allocated) from its start
+    void enterBlock(LocalVarTable *vars)
     {
-        auto &tracker = local_vars_tracker.back();
-        tracker.insert({var_name, reg});
+        local_vars.enterScope();
+        for (auto &slot : vars->getSlots())
+        {
+            if (slot.sym != StringInterner::INVALID_SYMBOL)
+                local_vars.bind(slot.sym, LocalVar{slot.type});
+        }
     }
 
-    ValueType::Type getValType(std::string& _var_name)
+    void exitBlock() { local_vars.exitScope(); }
+
+    void recordLocalVar(Symbol var_sym, Value* reg)
     {
-        for (int i = local_vars_ref.size() - 1;
-                 i >= 0;
-                 i--)
-        {
-            auto &ref = local_vars_ref[i];
+        auto var = local_vars.find(var_sym);
+        assert(var != nullptr);
+        var->reg = reg;
+    }
 
-            if (auto iter = ref->find(_var_name);
-                    iter != ref->end())
-            {
-                return iter->second;
-            }
-        }
+    ValueType::Type getValType(Symbol _var_sym)
+    {
+        auto var = local_vars.find(_var_sym);
+        assert(var != nullptr);
+        return var->type;
     }
     
-    std::pair<bool,Value*> getReg(std::string& _var_name)
+    std::pair<bool,Value*> getReg(Symbol _var_sym)
     {
-        for (int i = local_vars_tracker.size() - 1;
-                 i >= 0;
-                 i--)
-        {
-            auto &tracker = local_vars_tracker[i];
+        auto var = local_vars.find(_var_sym);
+        if (var == nullptr || var->reg == nullptr)
+            return std::make_pair(false,nullptr);
 
-            if (auto iter = tracker.find(_var_name);
-                    iter != tracker.end())
-            {
-                return std::make_pair(true,iter->second);
-            }
-        }
-        return std::make_pair(false,nullptr);
+        return std::make_pair(true,var->reg);
     }
 
-    void statementGen(std::string&, Statement*);
+    unsigned getSsaVar(Symbol _var_sym)
+    {
+        auto var = local_vars.find(_var_sym);
+        if (var == nullptr) return NO_SSA_VAR;
+        return var->ssa_var;
+    }
 
+    /*
+     * Direct SSA construction (opts.ssa), after Braun et al., "Simple and
+     * Efficient Construction of Static Single Assignment Form" (CC 2013).
+     *
+     * Every scalar of the function being lowered is an SSA variable with,
+     * per basic block, the value last assigned to it there. Reading it in
+     * a block that has none looks through the predecessors and places a
+     * phi where more than one may reach; a phi found to merge a single
+     * value is removed again. A block is sealed once all its predecessors
+     * have been created; phis placed in it before that are incomplete and
+     * get their operands on sealing. ifGen() seals its merge block after
+     * both paths branch to it, forGen() the loop header after the back
+     * edge.
+     *
+     * Values are held in WeakTrackingVH, so removing a phi with
+     * replaceAllUsesWith() also updates the definitions recorded here.
+     * */
+    std::vector<Type*> ssa_var_types;
+    DenseMap<std::pair<BasicBlock*, unsigned>, WeakTrackingVH> current_defs;
+    DenseMap<BasicBlock*,
+             SmallVector<std::pair<unsigned, PHINode*>, 4>> incomplete_phis;
+    SmallPtrSet<BasicBlock*, 32> sealed_blocks;
+
+    unsigned declareSsaVar(Symbol, ValueType::Type);
+    void writeVariable(unsigned var, BasicBlock *BB, Value *val)
+    {
+        current_defs[std::make_pair(BB, var)] = val;
+    }
+    Value *readVariable(unsigned, BasicBlock*);
+    Value *readVariableRecursive(unsigned, BasicBlock*);
+    PHINode *createPhi(unsigned, BasicBlock*);
+    Value *addPhiOperands(unsigned, PHINode*);
+    Value *tryRemoveTrivialPhi(PHINode*);
+    // All predecessors of BB are known (no-op without opts.ssa)
+    void sealBlock(BasicBlock*);
+
+    // Every alloca goes to the entry block, after the ones made before
+    // it, so that a variable declared in a loop does not grow the stack
+    // on every iteration and mem2reg/SROA can promote it
+    AllocaInst *last_alloca = nullptr;
+    Value *createEntryAlloca(Type *type);
+
+    void statementGen(Symbol, Statement*);
+
+    void funcDeclGen(Statement *);
+    Function *funcDecl(Symbol sym, StringRef func_name);
     void funcGen(Statement *);
     void assnGen(Statement *);
     void builtinGen(Statement *);
     void callGen(Statement *);
-    void retGen(std::string &,Statement *);
+    void retGen(Symbol,Statement *);
 
     Value* condGen(Condition*);
-    void ifGen(std::string&,Statement *);
-    void forGen(std::string&,Statement *);
+    void ifGen(Symbol,Statement *);
+    void forGen(Symbol,Statement *);
 
-    Value* allocaForIden(std::string&,
+    Value* allocaForIden(std::string_view&,
                          ValueType::Type&,
                          Expression*,
                          ArrayExpression*);
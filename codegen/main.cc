@@ -1,19 +1,153 @@
+#include "parser/ast_cache.hh"
 #include "parser/parser.hh"
 #include "codegen/codegen.hh"
 
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <string>
 
 using namespace Frontend;
 
+// Usage: ./codegen <source> [<output>] [--threads N] [--token-cache DIR]
+//                                      [--parse-threads N] [--ast-cache DIR]
+//                                      [--pipeline] [-O<n>] [--time-passes]
+//                                      [--ssa] [--emit bc|obj|asm]
+//                                      [--target TRIPLE] [--mcpu CPU]
+//                                      [--run]
+//   <source>: a file, or "-" to stream stdin (pipes are streamed too)
+//   <output>: the file to write, required unless --run is given
+//   --threads: lex the file on N threads before parsing
+//   --token-cache: reuse/write the binary token stream in DIR
+//   --parse-threads: parse the function bodies on N threads (the
+//                    signatures are always recorded first, so a call
+//                    may come before the callee's definition)
+//   --ast-cache: reuse/write the binary AST in DIR, an unchanged source
+//                is then neither lexed nor parsed
+//   --pipeline: lower every function as soon as it is parsed and free
+//               its AST, instead of parsing the whole file first
+//               (parses serially, ignores --parse-threads/--ast-cache)
+//   -O<n>: optimize the module with the standard pipeline of level n
+//          (0-3, default 0: no optimization)
+//   --time-passes: report the time spent in every optimization pass
+//   --ssa: build SSA values for scalar variables directly instead of
+//          going through allocas, loads and stores
+//   --emit: write <output> as LLVM bitcode (default), a native object
+//           file or assembly; link an object with util/print.c, e.g.
+//           clang prog.o util/print.c -o prog
+//   --target: generate code for TRIPLE instead of the host
+//   --mcpu: CPU to tune and select instructions for ("native": host's)
+//           (also recorded in bitcode output)
+//   --run: compile the program in memory and run its main, instead of
+//          writing <output>; exits with what main returns
 int main(int argc, char* argv[])
 {
-    // Parser
-    Parser parser(argv[1]);
-
-    // LLVM IR generation
-    Codegen codegen(argv[1], argv[2]);
-    codegen.setParser(&parser);
-    codegen.gen();
-    codegen.print();
+    bool pipeline = false;
+    bool run = false;
+    LexOptions lex_opts;
+    ParseOptions parse_opts;
+    CodegenOptions codegen_opts;
+
+    // Anything after <source> that is not an option is <output>
+    const char *out_fn = nullptr;
+    int first_opt = 2;
+    if (argc > 2 && (argv[2][0] != '-' || argv[2][1] == '\0'))
+    {
+        out_fn = argv[2];
+        first_opt = 3;
+    }
+
+    for (int i = first_opt; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--pipeline") == 0)
+            pipeline = true;
+        else if (strncmp(argv[i], "-O", 2) == 0)
+        {
+            const char *level = argv[i] + 2;
+            if (level[0] < '0' || level[0] > '3' || level[1] != '\0')
+            {
+                std::cerr << "[Error] unsupported optimization level "
+                          << argv[i] << "\n";
+                return 1;
+            }
+            codegen_opts.opt_level = level[0] - '0';
+        }
+        else if (strcmp(argv[i], "--time-passes") == 0)
+            codegen_opts.time_passes = true;
+        else if (strcmp(argv[i], "--ssa") == 0)
+            codegen_opts.ssa = true;
+        else if (strcmp(argv[i], "--run") == 0)
+            run = true;
+        else if (i + 1 == argc)
+            break;
+        else if (strcmp(argv[i], "--threads") == 0)
+            lex_opts.threads = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--token-cache") == 0)
+            lex_opts.token_cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--parse-threads") == 0)
+            parse_opts.threads = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--ast-cache") == 0)
+            parse_opts.ast_cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--emit") == 0)
+        {
+            std::string kind = argv[++i];
+            if (kind == "bc")
+                codegen_opts.emit = CodegenOptions::Emit::BITCODE;
+            else if (kind == "obj")
+                codegen_opts.emit = CodegenOptions::Emit::OBJECT;
+            else if (kind == "asm")
+                codegen_opts.emit = CodegenOptions::Emit::ASSEMBLY;
+            else
+            {
+                std::cerr << "[Error] --emit: unknown kind " << kind << "\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--target") == 0)
+            codegen_opts.target_triple = argv[++i];
+        else if (strcmp(argv[i], "--mcpu") == 0)
+            codegen_opts.mcpu = argv[++i];
+    }
+
+    if (out_fn == nullptr && !run)
+    {
+        std::cerr << "[Error] missing <output>, needed unless --run\n";
+        return 1;
+    }
+
+    Codegen codegen(argv[1], (out_fn != nullptr) ? out_fn : "",
+                    codegen_opts);
+    if (pipeline)
+    {
+        // Parser and LLVM IR generation, one function at a time
+        codegen.init();
+        parse_opts.on_function = [&codegen](Parser *parser,
+                                            Statement *func)
+        {
+            codegen.genFunction(parser, func);
+        };
+        Parser parser(argv[1], lex_opts, parse_opts);
+        codegen.optimize();
+    }
+    else
+    {
+        // Parser
+        Parser parser(argv[1], lex_opts, parse_opts);
+
+        // LLVM IR generation
+        codegen.setParser(&parser);
+        codegen.gen();
+        codegen.optimize();
+    }
+
+    int ret = 0;
+    if (run)
+        ret = codegen.run();
+    else
+        codegen.print();
+
+    if (lex_opts.token_cache_dir != nullptr) TokenCache::reportStats();
+    if (parse_opts.ast_cache_dir != nullptr) AstCache::reportStats();
+
+    return ret;
 }
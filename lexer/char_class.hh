@@ -0,0 +1,93 @@
+#ifndef __CHAR_CLASS_HH__
+#define __CHAR_CLASS_HH__
+
+#include <array>
+#include <cstdint>
+
+namespace Frontend
+{
+/*
+ * Character classification used by the lexer's scanning loop.
+ *
+ * Every byte maps to a set of flags through a 256-entry table built at
+ * compile time, so classifying a character is a single load instead of
+ * a hash lookup.
+ * */
+namespace CharClass
+{
+enum : uint8_t
+{
+    // single-character token, e.g., "+" or "{"
+    SEP = 1 << 0,
+    // space, tab and the like, separates tokens
+    SPACE = 1 << 1,
+    // 0-9
+    DIGIT = 1 << 2,
+    // a-z, A-Z, _
+    IDENT_START = 1 << 3,
+    // a-z, A-Z, _, 0-9
+    IDENT_CONT = 1 << 4,
+    // anything that belongs to a multi-character token (identifiers,
+    // keywords, numbers and whatever else the user typed)
+    WORD = 1 << 5
+};
+
+constexpr bool isSepChar(unsigned char c)
+{
+    switch (c)
+    {
+        case '=': case '+': case '-': case '!':
+        case '*': case '/': case '<': case '>':
+        case ',': case ';':
+        case '(': case ')': case '{': case '}': case '[': case ']':
+            return true;
+        default:
+            return false;
+    }
+}
+
+constexpr std::array<uint8_t, 256> makeTable()
+{
+    std::array<uint8_t, 256> table{};
+    for (unsigned c = 0; c < 256; c++)
+    {
+        uint8_t flags = 0;
+
+        if (isSepChar(c))
+            flags |= SEP;
+        else if (c == ' ' || c == '\t' || c == '\r' ||
+                 c == '\v' || c == '\f')
+            flags |= SPACE;
+        else if (c != '\n')
+            flags |= WORD;
+
+        if (c >= '0' && c <= '9')
+            flags |= DIGIT | IDENT_CONT;
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+            flags |= IDENT_START | IDENT_CONT;
+
+        table[c] = flags;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint8_t, 256> table = makeTable();
+
+constexpr uint8_t get(char c) { return table[static_cast<unsigned char>(c)]; }
+
+constexpr bool isSep(char c) { return get(c) & SEP; }
+constexpr bool isSpace(char c) { return get(c) & SPACE; }
+constexpr bool isDigit(char c) { return get(c) & DIGIT; }
+constexpr bool isIdentStart(char c) { return get(c) & IDENT_START; }
+constexpr bool isIdentCont(char c) { return get(c) & IDENT_CONT; }
+constexpr bool isWord(char c) { return get(c) & WORD; }
+
+static_assert(isSep('{') && !isWord('{'), "separator table");
+static_assert(isSpace('\t') && !isWord(' '), "whitespace table");
+static_assert(isWord('.') && isDigit('7') && !isIdentStart('7'),
+              "word table");
+}
+}
+
+#endif
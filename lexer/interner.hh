@@ -0,0 +1,109 @@
+#ifndef __INTERNER_HH__
+#define __INTERNER_HH__
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * StringInterner - maps every distinct identifier to a dense 32-bit id.
+ *
+ * Only views are stored, the caller must keep the underlying characters
+ * alive (identifiers point into the source buffer, built-in names are
+ * string literals). Lookup is an open-addressing table keyed by the
+ * FNV-1a hash of the string.
+ * */
+class StringInterner
+{
+  public:
+    using Symbol = uint32_t;
+
+    static constexpr Symbol INVALID_SYMBOL = UINT32_MAX;
+
+  protected:
+    struct Slot
+    {
+        uint32_t hash = 0;
+        Symbol sym = INVALID_SYMBOL;
+    };
+
+    // power-of-two sized hash table
+    std::vector<Slot> slots;
+    // id -> string
+    std::vector<std::string_view> strs;
+
+  public:
+    StringInterner() : slots(1024) {}
+
+    static uint32_t hash(std::string_view str)
+    {
+        uint32_t h = 2166136261u;
+        for (unsigned char c : str)
+        {
+            h ^= c;
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    Symbol intern(std::string_view str)
+    {
+        uint32_t h = hash(str);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask; ; i = (i + 1) & mask)
+        {
+            auto &slot = slots[i];
+            if (slot.sym == INVALID_SYMBOL)
+            {
+                slot.hash = h;
+                slot.sym = strs.size();
+                strs.push_back(str);
+
+                // keep the load factor under 1/2
+                if (strs.size() * 2 > slots.size()) grow();
+                return strs.size() - 1;
+            }
+
+            if (slot.hash == h && strs[slot.sym] == str) return slot.sym;
+        }
+    }
+
+    // Returns INVALID_SYMBOL if the string has never been interned
+    Symbol lookup(std::string_view str) const
+    {
+        uint32_t h = hash(str);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask; ; i = (i + 1) & mask)
+        {
+            auto &slot = slots[i];
+            if (slot.sym == INVALID_SYMBOL) return INVALID_SYMBOL;
+            if (slot.hash == h && strs[slot.sym] == str) return slot.sym;
+        }
+    }
+
+    std::string_view str(Symbol sym) const { return strs[sym]; }
+
+    size_t size() const { return strs.size(); }
+
+  protected:
+    void grow()
+    {
+        std::vector<Slot> old(slots.size() * 2);
+        old.swap(slots);
+
+        size_t mask = slots.size() - 1;
+        for (auto &slot : old)
+        {
+            if (slot.sym == INVALID_SYMBOL) continue;
+
+            size_t i = slot.hash & mask;
+            while (slots[i].sym != INVALID_SYMBOL) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+};
+}
+
+#endif
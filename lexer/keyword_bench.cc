@@ -0,0 +1,87 @@
+#include "lexer/lexer.hh"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace Frontend;
+
+// Keyword lookup microbenchmark: the constexpr perfect hash against the
+// std::unordered_map<std::string, TokenType> the lexer used to build.
+//
+// Usage: ./keyword_bench [number of words]
+
+int main(int argc, char* argv[])
+{
+    size_t num_words = (argc > 1) ? std::stoul(argv[1]) : 10000000;
+
+    // A mix of keywords and identifiers, roughly what a program looks like
+    std::vector<std::string> pool =
+    {
+        "int", "float", "void", "return", "if", "else", "for",
+        "i", "j", "len", "arr", "min_idx", "swap", "printVarInt",
+        "printVarFloat", "main", "sum", "x", "y", "interval", "format",
+        "iffy", "fort", "elsewhere", "returned", "voided", "in"
+    };
+
+    std::vector<std::string_view> words;
+    words.reserve(num_words);
+    uint32_t rnd = 12345;
+    for (size_t i = 0; i < num_words; i++)
+    {
+        rnd = rnd * 1103515245 + 12345;
+        words.push_back(pool[(rnd >> 16) % pool.size()]);
+    }
+
+    // The old way: build the map, then a std::string per lookup
+    std::unordered_map<std::string, Token::TokenType> keywords;
+    for (auto &entry : keyword_list)
+    {
+        keywords.insert({std::string(entry.word), entry.type});
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    unsigned map_hits = 0;
+    auto start = Clock::now();
+    for (auto word : words)
+    {
+        std::string cur_token_str(word);
+        if (auto iter = keywords.find(cur_token_str);
+            iter != keywords.end())
+        {
+            map_hits += static_cast<unsigned>(iter->second);
+        }
+    }
+    std::chrono::duration<double, std::nano> map_time = Clock::now() - start;
+
+    unsigned hash_hits = 0;
+    start = Clock::now();
+    for (auto word : words)
+    {
+        auto type = lookupKeyword(word);
+        if (type != Token::TokenType::TOKEN_IDENTIFIER)
+        {
+            hash_hits += static_cast<unsigned>(type);
+        }
+    }
+    std::chrono::duration<double, std::nano> hash_time = Clock::now() - start;
+
+    if (map_hits != hash_hits)
+    {
+        std::cerr << "[Error] keyword_bench: lookups disagree\n";
+        return 1;
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "words:          " << num_words << "\n"
+              << "unordered_map:  " << map_time.count() / num_words
+              << " ns/word\n"
+              << "perfect hash:   " << hash_time.count() / num_words
+              << " ns/word\n"
+              << "speedup:        " << map_time.count() / hash_time.count()
+              << "x\n";
+}
@@ -1,7 +1,13 @@
 #include "lexer/lexer.hh"
+#include "lexer/simd.hh"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <thread>
 
 namespace Frontend
 {
@@ -68,165 +74,390 @@ std::string Token::prinTokenType()
         default:
             std::cerr << "[Error] prinTokenType: "
                       << "unsupported token type. \n";
-            exit(0);
+            exit(1);
     }
 }
 
-Lexer::Lexer(const char* fn)
+Lexer::Lexer(const char* fn) : code(fn), strings(own_strings)
 {
-    code.open(fn);
-    assert(code.good());
+    cur_pos = code.begin();
 
-    // fill pre-defined seperators
-    seps.insert({'=', Token::TokenType::TOKEN_ASSIGN});
-    seps.insert({'+', Token::TokenType::TOKEN_PLUS});
-    seps.insert({'-', Token::TokenType::TOKEN_MINUS});
-    seps.insert({'!', Token::TokenType::TOKEN_BANG});
-    seps.insert({'*', Token::TokenType::TOKEN_ASTERISK});
-    seps.insert({'/', Token::TokenType::TOKEN_SLASH});
-    seps.insert({'<', Token::TokenType::TOKEN_LT});
-    seps.insert({'>', Token::TokenType::TOKEN_GT});
-    seps.insert({',', Token::TokenType::TOKEN_COMMA});
-    seps.insert({';', Token::TokenType::TOKEN_SEMICOLON});
-    seps.insert({'(', Token::TokenType::TOKEN_LPAREN});
-    seps.insert({')', Token::TokenType::TOKEN_RPAREN});
-    seps.insert({'{', Token::TokenType::TOKEN_LBRACE});
-    seps.insert({'}', Token::TokenType::TOKEN_RBRACE});
-    seps.insert({'[', Token::TokenType::TOKEN_LBRACKET});
-    seps.insert({']', Token::TokenType::TOKEN_RBRACKET});
-
-    // fill pre-defined keywords
-    keywords.insert({"return", Token::TokenType::TOKEN_RETURN});
+    // Line table entries are 32-bit offsets
+    if (code.length() > UINT32_MAX)
+    {
+        std::cerr << "[Error] Lexer: " << fn << " exceeds 4GB\n";
+        exit(1);
+    }
+}
 
-    keywords.insert({"void", Token::TokenType::TOKEN_DES_VOID});
-    keywords.insert({"int", Token::TokenType::TOKEN_DES_INT});
-    keywords.insert({"float", Token::TokenType::TOKEN_DES_FLOAT});
+Lexer::Lexer(std::string &&text, StringInterner *strs)
+    : code(std::move(text))
+    , strings(strs != nullptr ? *strs : own_strings)
+{
+    cur_pos = code.begin();
 
-    keywords.insert({"if", Token::TokenType::TOKEN_IF});
-    keywords.insert({"else", Token::TokenType::TOKEN_ELSE});
-    keywords.insert({"for", Token::TokenType::TOKEN_FOR});
+    if (code.length() > UINT32_MAX)
+    {
+        std::cerr << "[Error] Lexer: source text exceeds 4GB\n";
+        exit(1);
+    }
 }
 
 bool Lexer::getToken(Token &tok)
 {
-    // Check if toks_per_line is empty or not
-    if (toks_per_line.size())
+    if (getTokens(&tok, 1) == 1) return true;
+
+    tok = Token(Token::TokenType::TOKEN_EOF);
+    return false;
+}
+
+size_t Lexer::getTokens(Token *buf, size_t n)
+{
+    size_t copied = 0;
+    while (copied < n)
     {
-        tok = toks_per_line.front();
-        toks_per_line.pop();
+        // Tokens loaded from the token cache are decoded straight into
+        // the caller's buffer
+        if (cache != nullptr && cache_pos < cache->numTokens())
+        {
+            size_t avail = std::min(n - copied,
+                                    cache->numTokens() - cache_pos);
+            auto entries = cache->getEntries() + cache_pos;
+            for (size_t i = 0; i < avail; i++)
+                buf[copied + i] = TokenCache::decode(entries[i],
+                                                     code.begin());
+            cache_pos += avail;
+            copied += avail;
+            continue;
+        }
+
+        if (pending_pos == pending.size() && !lexMore()) break;
+
+        size_t avail = std::min(n - copied, pending.size() - pending_pos);
+        std::copy_n(pending.data() + pending_pos, avail, buf + copied);
+        pending_pos += avail;
+        copied += avail;
+    }
+    return copied;
+}
+
+bool Lexer::lexMore()
+{
+    pending.clear();
+    pending_pos = 0;
+
+    // Tokens lexed up front by lexParallel()
+    if (cur_chunk < chunks.size())
+    {
+        pending = std::move(chunks[cur_chunk++].toks);
         return true;
     }
 
-    // Read a line
-    std::string line;
-    getline(code, line);
+    // Lex a few lines at a time so that callers asking for a batch do
+    // not come back for every line. Empty lines and comment-only lines
+    // produce no tokens.
+    //
+    // A streaming source is read further only once there is nothing
+    // left to hand out, so the parser gets every complete line as soon
+    // as it has arrived. No '\n' in [cur_pos, scanned).
+    const char *scanned = cur_pos;
+    while (pending.size() < LEX_BATCH)
+    {
+        if (cur_pos == code.end() &&
+            (!pending.empty() || !code.fill()))
+            break;
+
+        // Find the end of the current line, the last line may not
+        // have a trailing newline.
+        const char *eol = Simd::findNewline(std::max(scanned, cur_pos),
+                                            code.end());
+        if (eol == code.end() && code.isStreaming())
+        {
+            // the line may go on in the next read
+            if (!pending.empty()) break;
+            scanned = eol;
+            code.fill();
+            continue;
+        }
+
+        line_starts.push_back(cur_pos - code.begin());
+        parseLine(std::string_view(cur_pos, eol - cur_pos));
+
+        cur_pos = (eol == code.end()) ? eol : eol + 1;
+    }
+
+    return pending.size() != 0;
+}
 
-    // Return if EOF
-    if (code.eof())
+void Lexer::lexParallel(unsigned num_threads)
+{
+    assert(cur_pos == code.begin() && chunks.empty());
+    if (num_threads == 0) num_threads = 1;
+    // chunks are split over the whole input
+    code.fillAll();
+    chunks.resize(num_threads);
+
+    // (1) split at newline boundaries, chunks may end up empty
+    const char *prev = code.begin();
+    for (unsigned i = 0; i < num_threads; i++)
     {
-        tok = Token(Token::TokenType::TOKEN_EOF);
-        return false;
+        const char *end = code.end();
+        if (i != num_threads - 1)
+        {
+            end = std::max(prev, code.begin() +
+                                 code.length() * (i + 1) / num_threads);
+            end = Simd::findNewline(end, code.end());
+            if (end != code.end()) end++;
+        }
+
+        chunks[i].begin = prev;
+        chunks[i].end = end;
+        prev = end;
     }
 
-    // Parse the line
-    parseLine(line);
+    // (2) lex every chunk with its own interner
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < num_threads; i++)
+        workers.emplace_back(&Lexer::lexChunk, this, std::ref(chunks[i]));
+    lexChunk(chunks[0]);
+    for (auto &worker : workers) worker.join();
 
-    // Skip empty lines
-    while (toks_per_line.size() == 0)
+    // (3) merge the interners in chunk order. Each chunk numbers its
+    // identifiers by first occurrence, so the global ids come out the
+    // same as with sequential lexing.
+    std::vector<std::vector<StringInterner::Symbol>> remaps(num_threads);
+    for (unsigned i = 0; i < num_threads; i++)
     {
-        getline(code, line);
-        if (code.eof())
+        auto &local = chunks[i].strings;
+        remaps[i].resize(local.size());
+        for (StringInterner::Symbol sym = 0; sym < local.size(); sym++)
+            remaps[i][sym] = strings.intern(local.str(sym));
+
+        line_starts.insert(line_starts.end(),
+                           chunks[i].line_starts.begin(),
+                           chunks[i].line_starts.end());
+        std::vector<uint32_t>().swap(chunks[i].line_starts);
+        chunks[i].strings = StringInterner();
+    }
+
+    // (4) rewrite local symbols to global ones
+    auto remap = [&](unsigned i)
+    {
+        for (auto &tok : chunks[i].toks)
         {
-            tok = Token(Token::TokenType::TOKEN_EOF);
-            return false;
+            if (tok.type == Token::TokenType::TOKEN_IDENTIFIER)
+                tok.sym = remaps[i][tok.sym];
         }
+    };
+    workers.clear();
+    for (unsigned i = 1; i < num_threads; i++)
+        workers.emplace_back(remap, i);
+    remap(0);
+    for (auto &worker : workers) worker.join();
+
+    cur_pos = code.end();
+}
+
+bool Lexer::useTokenCache(const char *dir, unsigned num_threads)
+{
+    assert(cur_pos == code.begin() && chunks.empty());
+    // Cached symbol ids are only valid for a fresh table
+    assert(&strings == &own_strings && strings.size() == 0);
+    auto start = std::chrono::steady_clock::now();
+
+    // the key is a hash of the whole input
+    code.fillAll();
+
+    uint64_t hash = TokenCache::hashContent(code.view());
+    std::string fn = TokenCache::path(dir, hash);
 
-        parseLine(line);
+    auto loaded = std::make_unique<TokenCache>();
+    bool hit = loaded->load(fn, hash, code.length());
+    if (hit)
+    {
+        line_starts.assign(loaded->getLines(),
+                           loaded->getLines() + loaded->numLines());
+
+        // Interning in the original order reproduces the symbol ids
+        auto strs = loaded->getStrings();
+        for (size_t i = 0; i < loaded->numStrings(); i++)
+        {
+            std::string_view str(code.begin() + strs[i].offset,
+                                 strs[i].length);
+            [[maybe_unused]] auto sym = strings.intern(str);
+            assert(sym == i);
+        }
+
+        cache = std::move(loaded);
+        cur_pos = code.end();
+        TokenCache::stats.hits++;
+    }
+    else
+    {
+        TokenCache::stats.misses++;
+
+        lexParallel(num_threads);
+
+        std::vector<const std::vector<Token>*> toks;
+        for (auto &chunk : chunks) toks.push_back(&chunk.toks);
+
+        if (TokenCache::store(fn, hash, code.view(), toks,
+                              line_starts, strings))
+            TokenCache::stats.writes++;
     }
 
-    assert(toks_per_line.size() != 0);
-    // std::cout << "\n" << line << "\n";
-    tok = toks_per_line.front();
-    toks_per_line.pop();
-    return true;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    TokenCache::stats.seconds += elapsed.count();
+
+    return hit;
+}
+
+void Lexer::setup(const LexOptions &opts)
+{
+    if (opts.token_cache_dir != nullptr)
+        useTokenCache(opts.token_cache_dir, opts.threads);
+    else if (opts.threads > 1)
+        lexParallel(opts.threads);
 }
 
-void Lexer::parseLine(std::string &line)
+void Lexer::lexChunk(Chunk &chunk)
 {
-    std::shared_ptr<std::string> cur_line = 
-        std::make_shared<std::string>(line);
+    // a rough guess to avoid most of the regrowth
+    chunk.toks.reserve((chunk.end - chunk.begin) / 4);
+
+    auto emit = [&chunk](const Token &tok) { chunk.toks.push_back(tok); };
+    for (const char *pos = chunk.begin; pos != chunk.end; )
+    {
+        const char *eol = Simd::findNewline(pos, chunk.end);
+
+        chunk.line_starts.push_back(pos - code.begin());
+        lexLine(std::string_view(pos, eol - pos), chunk.strings, emit);
+
+        pos = (eol == chunk.end) ? eol : eol + 1;
+    }
+}
+
+const char *Lexer::tokenPos(const Token &tok)
+{
+    if (tok.type == Token::TokenType::TOKEN_EOF)
+    {
+        const char *pos = code.end();
+        while (pos != code.begin() && (pos[-1] == '\n' || pos[-1] == '\r'))
+            pos--;
+        return pos;
+    }
+
+    // Tokens made up by the parser (e.g., the 0 of a negation) do not
+    // point into the source buffer.
+    std::less<const char*> before;
+    if (before(tok.text, code.begin()) || !before(tok.text, code.end()))
+        return nullptr;
+
+    return tok.text;
+}
+
+std::string_view Lexer::getLine(const Token &tok)
+{
+    const char *pos = tokenPos(tok);
+    if (pos == nullptr || line_starts.empty())
+        return std::string_view();
+
+    uint32_t offset = pos - code.begin();
+    auto iter = std::upper_bound(line_starts.begin(),
+                                 line_starts.end(),
+                                 offset);
+    assert(iter != line_starts.begin());
+
+    const char *line = code.begin() + *(iter - 1);
+    const char *eol = Simd::findNewline(line, code.end());
+
+    return std::string_view(line, eol - line);
+}
+
+SourceLocation Lexer::getLocation(const Token &tok)
+{
+    const char *pos = tokenPos(tok);
+    if (pos == nullptr || line_starts.empty())
+        return SourceLocation();
+
+    auto iter = std::upper_bound(line_starts.begin(),
+                                 line_starts.end(),
+                                 uint32_t(pos - code.begin()));
+
+    SourceLocation loc;
+    loc.line = iter - line_starts.begin();
+    loc.col = pos - (code.begin() + *(iter - 1)) + 1;
+    return loc;
+}
+
+void Lexer::parseLine(std::string_view line)
+{
+    lexLine(line, strings,
+            [this](const Token &tok) { pending.push_back(tok); });
+}
+
+template<typename Emit>
+void Lexer::lexLine(std::string_view line,
+                    StringInterner &strs,
+                    Emit &&emit)
+{
+    const char *iter = line.data();
+    const char *end = line.data() + line.size();
 
     // Extract all the tokens from the current line
-    for (auto iter = line.begin(); iter != line.end(); iter++)
+    while (true)
     {
         // (1) skip space, tab, and comments
-        if (*iter == ' ' || *iter == '\t') continue;
-        if (*iter == '/'  && *(iter + 1) == '/') break;
+        iter = Simd::skipSpaces(iter, end);
+        if (iter == end) break;
+        if (*iter == '/'  && 
+            (iter + 1) != end && *(iter + 1) == '/') break;
 
         // start to process token
-        std::string cur_token_str(1, *iter);
+        const char *token_start = iter;
 
         // (2) is it a sep?
-        if (auto sep_iter = seps.find(*iter); 
-            sep_iter != seps.end())
+        if (CharClass::isSep(*iter))
         {
-            std::string literal = cur_token_str;
-            Token::TokenType type = sep_iter->second;
-            Token _tok(type, literal, cur_line);
+            std::string_view literal(token_start, 1);
+            emit(Token(sep_types[static_cast<unsigned char>(*iter)],
+                       literal));
 
-            toks_per_line.push(_tok);
-                
+            iter++;
             continue;
         }
 
-        // (3) parse the token
-        auto next = iter + 1;
-        while (next != line.end())
+        // (3) parse the token, runs until the next space or sep
+        const char *next = Simd::findWordEnd(iter, end);
+        iter = next;
+
+        std::string_view literal(token_start, next - token_start);
+        if (literal.size() > UINT16_MAX)
         {
-            auto next_sep_check = seps.find(*next);
-
-            if ((*next == ' ') || (next_sep_check != seps.end()))
-            {
-                break;
-            }
-            cur_token_str.push_back(*next);
-            next++;
-            iter++;
+            std::cerr << "[Error] Lexer: token longer than "
+                      << UINT16_MAX << " characters\n";
+            exit(1);
         }
 
-        if (isType<int>(cur_token_str))
+        // is the token a number?
+        if (auto num = scanNumber(literal); num.isInt())
         {
-            Token::TokenType type = Token::TokenType::TOKEN_INT;
-            Token _tok(type, cur_token_str, cur_line);
-            toks_per_line.push(_tok);
+            emit(Token(literal, num.int_val));
             continue;
         }
-        else if (isType<float>(cur_token_str))
+        else if (num.isFloat())
         {
-            Token::TokenType type = Token::TokenType::TOKEN_FLOAT;
-            Token _tok(type, cur_token_str, cur_line);
-            toks_per_line.push(_tok);
+            emit(Token(literal, num.float_val));
             continue;
         }
 
-        // is the token keywork?
-        if (auto k_iter = keywords.find(cur_token_str);
-            k_iter != keywords.end())
-        {
-            std::string literal = cur_token_str;
-            Token::TokenType type = k_iter->second;
-            Token _tok(type, literal, cur_line);
-
-            toks_per_line.push(_tok);
-        }
+        // is the token keywork? (identifier otherwise)
+        auto type = lookupKeyword(literal);
+        if (type == Token::TokenType::TOKEN_IDENTIFIER)
+            emit(Token(type, literal, strs.intern(literal)));
         else
-        {
-	    std::string literal = cur_token_str;
-            Token::TokenType type = Token::TokenType::TOKEN_IDENTIFIER;
-            Token _tok(type, literal, cur_line);
-
-            toks_per_line.push(_tok);
-        }
+            emit(Token(type, literal));
     }
 }
 }
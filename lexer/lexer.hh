@@ -1,24 +1,37 @@
 #ifndef __LEXER_HH__
 #define __LEXER_HH__
 
-#include <fstream>
+#include "lexer/char_class.hh"
+#include "lexer/interner.hh"
+#include "lexer/number.hh"
+#include "lexer/source.hh"
+#include "lexer/token_cache.hh"
+
+#include <array>
+#include <cstdint>
 #include <memory>
-#include <queue>
-#include <sstream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <vector>
 
 namespace Frontend
 {
 /*
  * Token struct definition
+ *
+ * Tokens are packed into 16 bytes and trivially copyable: a pointer to
+ * the token value inside the source buffer, its length, the token type,
+ * and either the interned symbol of an identifier or the parsed value
+ * of a number literal. The source line is not stored
+ * per token, Lexer::getLine() and Lexer::getLocation() recover it from
+ * the lexer's line table.
  * */
 struct Token
 {
     /*
      * Define token types
      * */
-    enum class TokenType : int
+    enum class TokenType : uint8_t
     {
         // illegal - indicates any unsupported token types
         TOKEN_ILLEGAL,
@@ -85,10 +98,21 @@ struct Token
         TOKEN_ELSE,
         // for - indicates the token is "for"
         TOKEN_FOR
-    } type = TokenType::TOKEN_ILLEGAL;
+    };
 
-    // literal - container of the token value
-    std::string literal = "";
+    // text - start of the token value inside the source buffer
+    const char *text = "";
+    union
+    {
+        // sym - interned symbol (identifiers)
+        StringInterner::Symbol sym = StringInterner::INVALID_SYMBOL;
+        // int_val/float_val - value of number literals
+        int32_t int_val;
+        float float_val;
+    };
+    // length - number of characters of the token value
+    uint16_t length = 0;
+    TokenType type = TokenType::TOKEN_ILLEGAL;
 
     // default constructor
     Token() {}
@@ -101,38 +125,55 @@ struct Token
     }
 
     // alternative constructor
-    Token(TokenType _type, std::string &_val)
-        : type(_type)
-        , literal(_val)
+    Token(TokenType _type, std::string_view _val)
+        : text(_val.data())
+        , length(_val.size())
+        , type(_type)
     {
     
     }
 
     // alternative constructor
     Token(TokenType _type, 
-          std::string &_val, 
-          std::shared_ptr<std::string> &_line)
-        : type(_type)
-        , literal(_val)
-        , line(_line)
+          std::string_view _val, 
+          StringInterner::Symbol _sym)
+        : text(_val.data())
+        , sym(_sym)
+        , length(_val.size())
+        , type(_type)
     {
     
     }
 
-    // copy constructor
-    Token(const Token &_tok)
-        : type(_tok.type)
-        , literal(_tok.literal)
-        , line(_tok.line)
+    // alternative constructor - int literal
+    Token(std::string_view _val, int32_t _int_val)
+        : text(_val.data())
+        , length(_val.size())
+        , type(TokenType::TOKEN_INT)
     {
-    
+        int_val = _int_val;
+    }
+
+    // alternative constructor - float literal
+    Token(std::string_view _val, float _float_val)
+        : text(_val.data())
+        , length(_val.size())
+        , type(TokenType::TOKEN_FLOAT)
+    {
+        float_val = _float_val;
     }
 
     // return token type string (implemented in lexer.cc)
     std::string prinTokenType();
 
-    auto &getLiteral() { return literal; }
+    std::string_view getLiteral() const
+    {
+        return std::string_view(text, length);
+    }
     auto &getTokenType() { return type; }
+    auto getSymbol() const { return sym; }
+    auto getIntValue() const { return int_val; }
+    auto getFloatValue() const { return float_val; }
 
     bool isTokenIden() { return type == TokenType::TOKEN_IDENTIFIER; }
 
@@ -170,43 +211,248 @@ struct Token
     bool isTokenIf() { return type == TokenType::TOKEN_IF; }
     bool isTokenElse() { return type == TokenType::TOKEN_ELSE; }
     bool isTokenFor() { return type == TokenType::TOKEN_FOR; }
+};
+static_assert(sizeof(Token) == 16, "Token should stay packed");
+
+// Token type of every separator character, indexed by the character
+constexpr std::array<Token::TokenType, 256> makeSepTypes()
+{
+    std::array<Token::TokenType, 256> types{};
+    for (auto &type : types) type = Token::TokenType::TOKEN_ILLEGAL;
+
+    types['='] = Token::TokenType::TOKEN_ASSIGN;
+    types['+'] = Token::TokenType::TOKEN_PLUS;
+    types['-'] = Token::TokenType::TOKEN_MINUS;
+    types['!'] = Token::TokenType::TOKEN_BANG;
+    types['*'] = Token::TokenType::TOKEN_ASTERISK;
+    types['/'] = Token::TokenType::TOKEN_SLASH;
+    types['<'] = Token::TokenType::TOKEN_LT;
+    types['>'] = Token::TokenType::TOKEN_GT;
+    types[','] = Token::TokenType::TOKEN_COMMA;
+    types[';'] = Token::TokenType::TOKEN_SEMICOLON;
+    types['('] = Token::TokenType::TOKEN_LPAREN;
+    types[')'] = Token::TokenType::TOKEN_RPAREN;
+    types['{'] = Token::TokenType::TOKEN_LBRACE;
+    types['}'] = Token::TokenType::TOKEN_RBRACE;
+    types['['] = Token::TokenType::TOKEN_LBRACKET;
+    types[']'] = Token::TokenType::TOKEN_RBRACKET;
+    return types;
+}
 
-    std::shared_ptr<std::string> line;
-    std::string& getLine() { return *line; }
+/*
+ * Keyword recognition
+ *
+ * Keywords live in a 16-slot table indexed by a perfect hash of the
+ * first character, the last character and the length. The multiplier
+ * that makes the hash collision-free is searched at compile time, so a
+ * lookup is one hash, one load and one string_view compare.
+ * */
+struct KeywordEntry
+{
+    std::string_view word;
+    Token::TokenType type = Token::TokenType::TOKEN_IDENTIFIER;
+};
+
+inline constexpr KeywordEntry keyword_list[] = 
+{
+    {"return", Token::TokenType::TOKEN_RETURN},
+
+    {"void", Token::TokenType::TOKEN_DES_VOID},
+    {"int", Token::TokenType::TOKEN_DES_INT},
+    {"float", Token::TokenType::TOKEN_DES_FLOAT},
+
+    {"if", Token::TokenType::TOKEN_IF},
+    {"else", Token::TokenType::TOKEN_ELSE},
+    {"for", Token::TokenType::TOKEN_FOR}
+};
+
+inline constexpr unsigned KEYWORD_TABLE_SIZE = 16;
+inline constexpr size_t KEYWORD_MAX_LENGTH = 6;
+
+constexpr unsigned keywordHash(std::string_view word, unsigned seed)
+{
+    return (static_cast<unsigned char>(word.front()) * seed + 
+            static_cast<unsigned char>(word.back()) +
+            word.size()) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+constexpr unsigned findKeywordSeed()
+{
+    for (unsigned seed = 1; seed < 4096; seed++)
+    {
+        bool used[KEYWORD_TABLE_SIZE] = {};
+        bool collision = false;
+        for (auto &entry : keyword_list)
+        {
+            auto slot = keywordHash(entry.word, seed);
+            if (used[slot]) collision = true;
+            used[slot] = true;
+        }
+        if (!collision) return seed;
+    }
+    return 0;
+}
+
+inline constexpr unsigned keyword_seed = findKeywordSeed();
+static_assert(keyword_seed != 0, "no perfect hash for the keywords");
+
+constexpr std::array<KeywordEntry, KEYWORD_TABLE_SIZE> makeKeywordTable()
+{
+    std::array<KeywordEntry, KEYWORD_TABLE_SIZE> table{};
+    for (auto &entry : keyword_list)
+    {
+        table[keywordHash(entry.word, keyword_seed)] = entry;
+    }
+    return table;
+}
+
+inline constexpr std::array<KeywordEntry, KEYWORD_TABLE_SIZE> keyword_table =
+    makeKeywordTable();
+
+// Returns TOKEN_IDENTIFIER if the word is not a keyword
+constexpr Token::TokenType lookupKeyword(std::string_view word)
+{
+    if (word.empty() || word.size() > KEYWORD_MAX_LENGTH)
+        return Token::TokenType::TOKEN_IDENTIFIER;
+
+    auto &entry = keyword_table[keywordHash(word, keyword_seed)];
+    return (entry.word == word) ? entry.type
+                                : Token::TokenType::TOKEN_IDENTIFIER;
+}
+
+static_assert(lookupKeyword("return") == Token::TokenType::TOKEN_RETURN &&
+              lookupKeyword("else") == Token::TokenType::TOKEN_ELSE &&
+              lookupKeyword("fo") == Token::TokenType::TOKEN_IDENTIFIER &&
+              lookupKeyword("floats") == 
+                  Token::TokenType::TOKEN_IDENTIFIER,
+              "keyword table");
+
+// 1-based position of a token in the source, line 0 if it has none
+struct SourceLocation
+{
+    uint32_t line = 0;
+    uint32_t col = 0;
+};
+
+// How the drivers want the lexer to produce its tokens
+struct LexOptions
+{
+    // > 1 lexes the whole file up front on that many threads
+    unsigned threads = 1;
+    // directory of the binary token cache, nullptr disables it
+    const char *token_cache_dir = nullptr;
 };
 
 class Lexer
 {
   protected:
     // define seperators
-    std::unordered_map<char, Token::TokenType> seps;
-    // define keywords
-    std::unordered_map<std::string, Token::TokenType> keywords;
+    static constexpr std::array<Token::TokenType, 256> sep_types = 
+        makeSepTypes();
 
   protected:
-    std::ifstream code;
+    // The whole source file (or, when streaming, what has been read of
+    // it so far), tokens are views into it
+    SourceBuffer code;
+    // Start of the next line to be parsed
+    const char *cur_pos;
+
+    // Offset of the first character of every line seen so far
+    std::vector<uint32_t> line_starts;
+
+    // Identifier symbols, strings refers either to own_strings or to a
+    // table shared with other lexers
+    StringInterner own_strings;
+    StringInterner &strings;
+
+    // Lexed but not yet handed out tokens, the storage is reused
+    static constexpr size_t LEX_BATCH = 64;
+    std::vector<Token> pending;
+    size_t pending_pos = 0;
+
+    // A slice of the source lexed on its own thread by lexParallel().
+    // Symbols in toks are global once the chunk interners are merged.
+    struct Chunk
+    {
+        const char *begin;
+        const char *end;
 
-    std::queue<Token> toks_per_line;
+        std::vector<Token> toks;
+        std::vector<uint32_t> line_starts;
+        StringInterner strings;
+    };
+    std::vector<Chunk> chunks;
+    // Next chunk to move into pending
+    size_t cur_chunk = 0;
+
+    // Tokens loaded from the token cache
+    std::unique_ptr<TokenCache> cache;
+    size_t cache_pos = 0;
 
   public:
+    // "-" reads stdin; pipes and other non-regular files are streamed
     Lexer(const char*);
-    ~Lexer() { code.close(); };
+    // Lexes text held in memory. With strs, identifiers are interned
+    // there so that symbols agree with the lexer that owns strs.
+    Lexer(std::string &&text, StringInterner *strs = nullptr);
 
     bool getToken(Token&);
+
+    // Copies up to n tokens into buf, returns how many were copied (less
+    // than n only at the end of the file). EOF is not included.
+    size_t getTokens(Token *buf, size_t n);
+
+    // Lex the whole file up front on num_threads threads. The file is
+    // split at newline boundaries (no token spans lines), every chunk
+    // is lexed into its own token vector, and getToken() then hands the
+    // tokens out in source order. Must be called before the first
+    // getToken(). A streaming source is read to its end first.
+    void lexParallel(unsigned num_threads);
+
+    // Loads the tokens from the cache in dir if this exact content has
+    // been lexed before (returns true). Otherwise lexes the whole file
+    // (on num_threads threads) and writes the cache for the next run.
+    // Must be called before the first getToken(). A streaming source is
+    // read to its end first.
+    bool useTokenCache(const char *dir, unsigned num_threads);
+
+    // Applies the driver options, call before the first getToken()
+    void setup(const LexOptions &opts);
+
+    // Source line containing the token, empty if the token does not
+    // come from the source buffer. EOF is on the last line.
+    std::string_view getLine(const Token&);
+
+    // Line and column of the token (column in bytes)
+    SourceLocation getLocation(const Token&);
+
+    auto &getStrings() { return strings; }
+
+    std::string_view getSource() { return code.view(); }
+
+    // Reads a streaming source to its end, getSource() then has all of it
+    void fillSource() { code.fillAll(); }
+
+    size_t getSourceSize() { return code.length(); }
     
   protected:
-    void parseLine(std::string &line);
+    // Refills pending, false at the end of the file
+    bool lexMore();
 
-    // helper function
-    template<typename T>
-    bool isType(std::string &cur_token_str)
-    {
-        std::istringstream iss(cur_token_str);
-        T float_check;
-        iss >> std::noskipws >> float_check;
-        if (iss.eof() && !iss.fail()) return true;
-        else return false;
-    }
+    // Where the token starts in the source buffer, nullptr if it is not
+    // in there. EOF sits right after the last character.
+    const char *tokenPos(const Token&);
+
+    void parseLine(std::string_view line);
+
+    void lexChunk(Chunk &chunk);
+
+    // Splits one line into tokens, passing each to emit. Identifiers are
+    // interned into strs. (Only instantiated in lexer.cc.)
+    template<typename Emit>
+    static void lexLine(std::string_view line,
+                        StringInterner &strs,
+                        Emit &&emit);
 };
 
 }
@@ -1,21 +1,65 @@
 #include "lexer/lexer.hh"
+#include "lexer/simd.hh"
 
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <string>
 
 using namespace Frontend;
 
+// Usage: ./lexer <source> [--stats] [--threads N] [--token-cache DIR]
+//   <source>: a file, or "-" to stream stdin (pipes are streamed too)
+//   --stats: lex without printing, report token count and throughput
+//   --threads: lex the file on N threads up front
+//   --token-cache: reuse/write the binary token stream in DIR
 int main(int argc, char* argv[])
 {
+    bool stats = false;
+    LexOptions opts;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--stats") == 0) stats = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            opts.threads = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--token-cache") == 0 && i + 1 < argc)
+            opts.token_cache_dir = argv[++i];
+    }
+
+    auto start = std::chrono::steady_clock::now();
     Lexer lexer(argv[1]);
+    lexer.setup(opts);
 
     Token tok;
+    size_t num_toks = 0;
     while (lexer.getToken(tok))
     {
-        
+        num_toks++;
+        if (stats) continue;
+
         std::cout << std::setw(12)
                   << tok.prinTokenType() << " | "
                   << tok.getLiteral() << "\n";
-        
+
+    }
+
+    if (stats)
+    {
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        double bytes = lexer.getSourceSize();
+
+        std::cout << "kernels: " << Simd::kernels().name << "\n"
+                  << "threads: " << opts.threads << "\n"
+                  << "bytes:   " << lexer.getSourceSize() << "\n"
+                  << "tokens:  " << num_toks << "\n"
+                  << "seconds: " << elapsed.count() << "\n"
+                  << "GB/s:    " << bytes / elapsed.count() / 1e9 << "\n";
+    }
+
+    if (opts.token_cache_dir != nullptr)
+    {
+        TokenCache::reportStats();
     }
 }
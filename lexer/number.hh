@@ -0,0 +1,132 @@
+#ifndef __NUMBER_HH__
+#define __NUMBER_HH__
+
+#include "lexer/char_class.hh"
+
+#include <charconv>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+
+namespace Frontend
+{
+/*
+ * Number literal scanner.
+ *
+ * A small DFA decides whether a word is an int or a float literal and
+ * computes its value on the way, replacing the istringstream round
+ * trips. Accepted forms (signs are separate tokens):
+ *
+ *   INT   := DIGIT+                       (must fit in 32 bits)
+ *   FLOAT := DIGIT* '.' DIGIT* EXP?       (at least one DIGIT)
+ *          | DIGIT+ EXP
+ *   EXP   := ('e' | 'E') DIGIT+
+ *
+ * An INT that overflows is treated as a FLOAT, matching what the old
+ * istream-based check did.
+ * */
+struct NumberLiteral
+{
+    enum class Kind : int
+    {
+        NONE,
+        INT,
+        FLOAT
+    } kind = Kind::NONE;
+
+    int32_t int_val = 0;
+    float float_val = 0;
+
+    bool isNumber() const { return kind != Kind::NONE; }
+    bool isInt() const { return kind == Kind::INT; }
+    bool isFloat() const { return kind == Kind::FLOAT; }
+};
+
+inline NumberLiteral scanNumber(std::string_view word)
+{
+    enum class State : int
+    {
+        START,
+        INT_PART,   // DIGIT+
+        DOT,        // '.' without any digit yet
+        FRAC_PART,  // DIGIT* '.' DIGIT*, seen at least one digit
+        EXP_MARK,   // ... 'e'
+        EXP_PART    // ... 'e' DIGIT+
+    } state = State::START;
+
+    NumberLiteral num;
+
+    // Cheap reject for identifiers and keywords
+    if (word.empty() ||
+        !(CharClass::isDigit(word[0]) || word[0] == '.'))
+        return num;
+
+    uint64_t int_val = 0;
+    bool int_overflow = false;
+    for (char c : word)
+    {
+        bool digit = CharClass::isDigit(c);
+        switch (state)
+        {
+            case State::START:
+                if (digit) state = State::INT_PART;
+                else if (c == '.') state = State::DOT;
+                else return num;
+                break;
+            case State::INT_PART:
+                if (digit) break;
+                else if (c == '.') state = State::FRAC_PART;
+                else if (c == 'e' || c == 'E') state = State::EXP_MARK;
+                else return num;
+                break;
+            case State::DOT:
+                if (digit) state = State::FRAC_PART;
+                else return num;
+                break;
+            case State::FRAC_PART:
+                if (digit) break;
+                else if (c == 'e' || c == 'E') state = State::EXP_MARK;
+                else return num;
+                break;
+            case State::EXP_MARK:
+            case State::EXP_PART:
+                if (digit) state = State::EXP_PART;
+                else return num;
+                break;
+        }
+
+        if (state == State::INT_PART && !int_overflow)
+        {
+            int_val = int_val * 10 + (c - '0');
+            int_overflow = int_val > INT32_MAX;
+        }
+    }
+
+    if (state == State::INT_PART && !int_overflow)
+    {
+        num.kind = NumberLiteral::Kind::INT;
+        num.int_val = static_cast<int32_t>(int_val);
+        return num;
+    }
+
+    if (state == State::INT_PART || state == State::FRAC_PART ||
+        state == State::EXP_PART)
+    {
+        // The DFA already validated the syntax, from_chars only does
+        // the correctly rounded conversion.
+        float val = 0;
+        auto [end, ec] = std::from_chars(word.data(),
+                                         word.data() + word.size(),
+                                         val);
+        if (ec == std::errc() && end == word.data() + word.size())
+        {
+            num.kind = NumberLiteral::Kind::FLOAT;
+            num.float_val = val;
+        }
+    }
+
+    return num;
+}
+}
+
+#endif
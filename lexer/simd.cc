@@ -0,0 +1,227 @@
+#include "lexer/simd.hh"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FRONTEND_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace Frontend
+{
+namespace Simd
+{
+/************************** Scalar fallback ******************************/
+static const char* skipSpacesScalar(const char *p, const char *end)
+{
+    while (p != end && CharClass::isSpace(*p)) p++;
+    return p;
+}
+
+static const char* findWordEndScalar(const char *p, const char *end)
+{
+    while (p != end && CharClass::isWord(*p)) p++;
+    return p;
+}
+
+static const char* findNewlineScalar(const char *p, const char *end)
+{
+    const char *nl = static_cast<const char*>(memchr(p, '\n', end - p));
+    return (nl == nullptr) ? end : nl;
+}
+
+#ifdef FRONTEND_SIMD_X86
+/*
+ * The vector kernels classify 16/32 bytes at once with range compares.
+ *
+ * Whitespace is ' ' or [\t, \r] minus '\n'. For words, the vector loop
+ * only recognizes the common characters [0-9A-Za-z_.] and stops at
+ * anything else; the scalar table then decides whether that byte really
+ * ends the word (e.g., a '$' inside an identifier does not).
+ * */
+
+/******************************** SSE2 ***********************************/
+// lo <= c <= hi, unsigned
+static inline __m128i inRange128(__m128i v, char lo, char hi)
+{
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    __m128i r = _mm_min_epu8(t, _mm_set1_epi8(hi - lo));
+    return _mm_cmpeq_epi8(r, t);
+}
+
+static inline __m128i isSpace128(__m128i v)
+{
+    __m128i ctrl = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                    inRange128(v, '\t', '\r'));
+    return _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static inline __m128i isWordFast128(__m128i v)
+{
+    // setting bit 5 maps A-Z onto a-z
+    __m128i alpha = inRange128(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                               'a', 'z');
+    __m128i digit = inRange128(v, '0', '9');
+    __m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+    return _mm_or_si128(_mm_or_si128(alpha, digit), other);
+}
+
+static const char* skipSpacesSSE2(const char *p, const char *end)
+{
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = ~_mm_movemask_epi8(isSpace128(v)) & 0xFFFF;
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return skipSpacesScalar(p, end);
+}
+
+static const char* findWordEndSSE2(const char *p, const char *end)
+{
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = ~_mm_movemask_epi8(isWordFast128(v)) & 0xFFFF;
+        if (mask == 0)
+        {
+            p += 16;
+            continue;
+        }
+
+        p += __builtin_ctz(mask);
+        if (!CharClass::isWord(*p)) return p;
+        p++;
+    }
+    return findWordEndScalar(p, end);
+}
+
+static const char* findNewlineSSE2(const char *p, const char *end)
+{
+    __m128i nl = _mm_set1_epi8('\n');
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return findNewlineScalar(p, end);
+}
+
+/******************************** AVX2 ***********************************/
+#define FRONTEND_AVX2 __attribute__((target("avx2")))
+
+FRONTEND_AVX2
+static inline __m256i inRange256(__m256i v, char lo, char hi)
+{
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    __m256i r = _mm256_min_epu8(t, _mm256_set1_epi8(hi - lo));
+    return _mm256_cmpeq_epi8(r, t);
+}
+
+FRONTEND_AVX2
+static inline __m256i isSpace256(__m256i v)
+{
+    __m256i ctrl =
+        _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                            inRange256(v, '\t', '\r'));
+    return _mm256_or_si256(ctrl,
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+FRONTEND_AVX2
+static inline __m256i isWordFast256(__m256i v)
+{
+    __m256i alpha = inRange256(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+                               'a', 'z');
+    __m256i digit = inRange256(v, '0', '9');
+    __m256i other =
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+    return _mm256_or_si256(_mm256_or_si256(alpha, digit), other);
+}
+
+FRONTEND_AVX2
+static const char* skipSpacesAVX2(const char *p, const char *end)
+{
+    while (end - p >= 32)
+    {
+        __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = ~static_cast<unsigned>(
+            _mm256_movemask_epi8(isSpace256(v)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return skipSpacesSSE2(p, end);
+}
+
+FRONTEND_AVX2
+static const char* findWordEndAVX2(const char *p, const char *end)
+{
+    while (end - p >= 32)
+    {
+        __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = ~static_cast<unsigned>(
+            _mm256_movemask_epi8(isWordFast256(v)));
+        if (mask == 0)
+        {
+            p += 32;
+            continue;
+        }
+
+        p += __builtin_ctz(mask);
+        if (!CharClass::isWord(*p)) return p;
+        p++;
+    }
+    return findWordEndSSE2(p, end);
+}
+
+FRONTEND_AVX2
+static const char* findNewlineAVX2(const char *p, const char *end)
+{
+    __m256i nl = _mm256_set1_epi8('\n');
+    while (end - p >= 32)
+    {
+        __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return findNewlineSSE2(p, end);
+}
+#endif
+
+Kernels selectKernels()
+{
+    Kernels scalar = {skipSpacesScalar, findWordEndScalar,
+                      findNewlineScalar, "scalar"};
+
+    const char *force = getenv("FRONTEND_SIMD");
+    if (force != nullptr && strcmp(force, "scalar") == 0) return scalar;
+
+#ifdef FRONTEND_SIMD_X86
+    Kernels sse2 = {skipSpacesSSE2, findWordEndSSE2,
+                    findNewlineSSE2, "sse2"};
+    Kernels avx2 = {skipSpacesAVX2, findWordEndAVX2,
+                    findNewlineAVX2, "avx2"};
+
+    if (force != nullptr && strcmp(force, "sse2") == 0) return sse2;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return avx2;
+
+    // SSE2 is part of x86-64, but not of every 32-bit x86
+    if (__builtin_cpu_supports("sse2")) return sse2;
+#endif
+
+    return scalar;
+}
+}
+}
@@ -0,0 +1,63 @@
+#ifndef __SIMD_HH__
+#define __SIMD_HH__
+
+#include "lexer/char_class.hh"
+
+namespace Frontend
+{
+/*
+ * Vectorized scanning kernels for the lexer's hot loops.
+ *
+ * Each kernel returns a pointer to the first byte in [p, end) that stops
+ * the run (or end). There are SSE2 and AVX2 versions, selected once at
+ * startup from the CPU features, plus a scalar fallback for other
+ * targets. The inline wrappers below handle the common one-byte case
+ * (a single space between tokens, a short identifier) without going
+ * through the function pointer.
+ * */
+namespace Simd
+{
+struct Kernels
+{
+    // first byte that is not whitespace (newline is not whitespace here)
+    const char* (*skip_spaces)(const char*, const char*);
+    // first byte that cannot continue a word (whitespace, sep, newline)
+    const char* (*find_word_end)(const char*, const char*);
+    // first '\n'
+    const char* (*find_newline)(const char*, const char*);
+
+    // name of the selected implementation, for diagnostics
+    const char *name;
+};
+
+// Picks the kernels for the running CPU (implemented in simd.cc). The
+// FRONTEND_SIMD environment variable (scalar, sse2, avx2) overrides the
+// choice, which is handy to compare implementations.
+Kernels selectKernels();
+
+inline const Kernels& kernels()
+{
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+inline const char* skipSpaces(const char *p, const char *end)
+{
+    if (p == end || !CharClass::isSpace(*p)) return p;
+    return kernels().skip_spaces(p + 1, end);
+}
+
+inline const char* findWordEnd(const char *p, const char *end)
+{
+    if (p == end || !CharClass::isWord(*p)) return p;
+    return kernels().find_word_end(p + 1, end);
+}
+
+inline const char* findNewline(const char *p, const char *end)
+{
+    return kernels().find_newline(p, end);
+}
+}
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include "lexer/source.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace Frontend
+{
+SourceBuffer::SourceBuffer(const char* fn)
+{
+    if (strcmp(fn, "-") == 0)
+    {
+        startStream(STDIN_FILENO, "<stdin>");
+        return;
+    }
+
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "[Error] SourceBuffer: cannot open " << fn << "\n";
+        exit(1);
+    }
+
+    struct stat st;
+    bool have_stat = (fstat(fd, &st) == 0);
+    if (have_stat && !S_ISREG(st.st_mode))
+    {
+        // pipe, FIFO, character device, /dev/fd/N, ...
+        startStream(fd, fn);
+        return;
+    }
+
+    if (have_stat && st.st_size > 0)
+    {
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            // The lexer walks the file front to back exactly once
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+            data = static_cast<const char*>(addr);
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+
+    // Not mappable, fall back to one big read
+    if (!mapped) readAll(fd);
+
+    close(fd);
+}
+
+SourceBuffer::SourceBuffer(std::string &&text) : owned(std::move(text))
+{
+    data = owned.data();
+    size = owned.size();
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    if (mapped) munmap(const_cast<char*>(data), size);
+    if (reserved != 0) munmap(const_cast<char*>(data), reserved);
+    if (stream_fd > STDERR_FILENO) close(stream_fd);
+}
+
+void SourceBuffer::startStream(int fd, const char *name)
+{
+    // Up to what the lexer's 32-bit line table can address, less on
+    // 32-bit hosts where that much address space is not available
+    reserved = (sizeof(void*) >= 8) ? size_t(UINT32_MAX) : size_t(1) << 30;
+
+    void *addr = mmap(nullptr, reserved, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        std::cerr << "[Error] SourceBuffer: cannot reserve memory for "
+                  << name << "\n";
+        exit(1);
+    }
+
+    data = static_cast<const char*>(addr);
+    size = 0;
+    stream_fd = fd;
+}
+
+bool SourceBuffer::fill()
+{
+    if (stream_fd < 0) return false;
+
+    if (size == reserved)
+    {
+        std::cerr << "[Error] SourceBuffer: streamed input exceeds "
+                  << reserved << " bytes\n";
+        exit(1);
+    }
+
+    // A pipe returns whatever the producer has written so far, so the
+    // lexer sees new lines as soon as they arrive
+    char *dst = const_cast<char*>(data) + size;
+    size_t want = std::min(STREAM_READ_SIZE, reserved - size);
+    ssize_t n;
+    do
+    {
+        n = read(stream_fd, dst, want);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+    {
+        std::cerr << "[Error] SourceBuffer: read failed: "
+                  << strerror(errno) << "\n";
+        exit(1);
+    }
+
+    if (n == 0)
+    {
+        if (stream_fd > STDERR_FILENO) close(stream_fd);
+        stream_fd = -1;
+        return false;
+    }
+
+    size += n;
+    return true;
+}
+
+void SourceBuffer::readAll(int fd)
+{
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+    {
+        owned.append(chunk, n);
+    }
+
+    data = owned.data();
+    size = owned.size();
+}
+}
@@ -0,0 +1,80 @@
+#ifndef __SOURCE_HH__
+#define __SOURCE_HH__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace Frontend
+{
+/*
+ * SourceBuffer - holds the whole source file in memory.
+ *
+ * Regular files are memory-mapped read-only, so the lexer scans the page
+ * cache directly and tokens can be handed out as views into the mapping.
+ * Empty files are read into an owned buffer instead, as is text handed
+ * over in memory (e.g., an edited region). Either way, the buffer must
+ * outlive every token that points into it.
+ *
+ * Pipes, FIFOs, terminals and stdin ("-") are streamed: the buffer
+ * reserves address space for the largest input the lexer accepts
+ * (MAP_NORESERVE, so only the pages actually read are backed), and
+ * fill() appends the next read() to it. The data never moves, so tokens
+ * lexed from the first part stay valid while the rest is being read,
+ * and the lexer can start before the producer has finished writing.
+ * */
+class SourceBuffer
+{
+  protected:
+    const char *data = nullptr;
+    size_t size = 0;
+
+    // true if data points to an mmap region we need to unmap
+    bool mapped = false;
+
+    // backing store when the file cannot be mapped
+    std::string owned;
+
+    // Streaming input: the descriptor still being read (-1 once it hit
+    // EOF, or if the source is not a stream) and the reserved region
+    int stream_fd = -1;
+    size_t reserved = 0;
+
+    // Bytes requested per read() when streaming
+    static constexpr size_t STREAM_READ_SIZE = 1 << 20;
+
+  public:
+    SourceBuffer(const char*);
+    explicit SourceBuffer(std::string &&text);
+    ~SourceBuffer();
+
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    const char *begin() const { return data; }
+    const char *end() const { return data + size; }
+    size_t length() const { return size; }
+
+    std::string_view view() const { return std::string_view(data, size); }
+
+    bool isMapped() const { return mapped; }
+
+    // true while more input may arrive (streaming sources before EOF)
+    bool isStreaming() const { return stream_fd >= 0; }
+
+    // Appends the next read of a streaming source, blocking until data
+    // or EOF arrive. Returns false at EOF (and for non-streaming
+    // sources), end() has moved otherwise.
+    bool fill();
+
+    // Reads a streaming source to its end
+    void fillAll() { while (fill()) {} }
+
+  protected:
+    void readAll(int fd);
+
+    void startStream(int fd, const char *name);
+};
+}
+
+#endif
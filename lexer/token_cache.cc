@@ -0,0 +1,204 @@
+#include "lexer/token_cache.hh"
+#include "lexer/lexer.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+namespace Frontend
+{
+static constexpr char CACHE_MAGIC[8] = {'F', 'E', 'T', 'O', 'K', 'C', 'A', 'C'};
+
+TokenCache::Stats TokenCache::stats;
+
+TokenCache::~TokenCache()
+{
+    if (map != nullptr) munmap(const_cast<char*>(map), map_size);
+}
+
+uint64_t TokenCache::hashContent(std::string_view content)
+{
+    // Multiply-xorshift over 8-byte words, a few GB/s. Not a
+    // cryptographic hash, the source size is checked as well.
+    constexpr uint64_t K = 0x9FB21C651E98DF25ull;
+
+    const char *p = content.data();
+    size_t n = content.size();
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ (n * K);
+
+    auto mix = [&](uint64_t w)
+    {
+        w *= K;
+        w ^= w >> 29;
+        h = (h ^ w) * K;
+        h ^= h >> 32;
+    };
+
+    for (; n >= 8; p += 8, n -= 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        mix(w);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    mix(tail);
+
+    return h;
+}
+
+std::string TokenCache::path(const char *dir, uint64_t content_hash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.tok",
+             static_cast<unsigned long long>(content_hash));
+    return std::string(dir) + name;
+}
+
+bool TokenCache::load(const std::string &fn, uint64_t content_hash,
+                      size_t source_size)
+{
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    map = static_cast<const char*>(addr);
+    map_size = st.st_size;
+    header = reinterpret_cast<const Header*>(map);
+
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header->version != VERSION ||
+        header->entry_size != sizeof(Entry) ||
+        header->content_hash != content_hash ||
+        header->source_size != source_size)
+        return false;
+
+    size_t expected = sizeof(Header) +
+                      header->num_tokens * sizeof(Entry) +
+                      header->num_lines * sizeof(uint32_t) +
+                      header->num_strings * sizeof(StrEntry);
+    if (expected != map_size) return false;
+
+    entries = reinterpret_cast<const Entry*>(map + sizeof(Header));
+    lines = reinterpret_cast<const uint32_t*>(entries + header->num_tokens);
+    strs = reinterpret_cast<const StrEntry*>(lines + header->num_lines);
+
+    // The lexer reads the entries front to back
+    madvise(addr, map_size, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+bool TokenCache::store(const std::string &fn, uint64_t content_hash,
+                       std::string_view source,
+                       const std::vector<const std::vector<Token>*> &toks,
+                       const std::vector<uint32_t> &line_starts,
+                       const StringInterner &strings)
+{
+    Header header = {};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = VERSION;
+    header.entry_size = sizeof(Entry);
+    header.content_hash = content_hash;
+    header.source_size = source.size();
+    for (auto vec : toks) header.num_tokens += vec->size();
+    header.num_lines = line_starts.size();
+    header.num_strings = strings.size();
+
+    // Every interned string must be a view into the source
+    std::vector<StrEntry> str_entries(strings.size());
+    std::less<const char*> before;
+    for (StringInterner::Symbol sym = 0; sym < strings.size(); sym++)
+    {
+        auto str = strings.str(sym);
+        if (before(str.data(), source.data()) ||
+            before(source.data() + source.size(), str.data() + str.size()))
+            return false;
+
+        str_entries[sym].offset = str.data() - source.data();
+        str_entries[sym].length = str.size();
+    }
+
+    std::string tmp_fn = fn + ".tmp." + std::to_string(getpid());
+    FILE *out = fopen(tmp_fn.c_str(), "wb");
+    if (out == nullptr) return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    // encode in batches to keep the temporary buffer small
+    std::vector<Entry> batch;
+    batch.reserve(4096);
+    for (auto vec : toks)
+    {
+        for (auto &tok : *vec)
+        {
+            batch.push_back(encode(tok, source.data()));
+            if (batch.size() == batch.capacity())
+            {
+                ok = ok && fwrite(batch.data(), sizeof(Entry),
+                                  batch.size(), out) == batch.size();
+                batch.clear();
+            }
+        }
+    }
+    ok = ok && fwrite(batch.data(), sizeof(Entry),
+                      batch.size(), out) == batch.size();
+
+    ok = ok && fwrite(line_starts.data(), sizeof(uint32_t),
+                      line_starts.size(), out) == line_starts.size();
+    ok = ok && fwrite(str_entries.data(), sizeof(StrEntry),
+                      str_entries.size(), out) == str_entries.size();
+
+    ok = (fclose(out) == 0) && ok;
+    ok = ok && rename(tmp_fn.c_str(), fn.c_str()) == 0;
+    if (!ok) unlink(tmp_fn.c_str());
+
+    return ok;
+}
+
+void TokenCache::reportStats()
+{
+    std::cerr << "[TokenCache] hits: " << stats.hits
+              << ", misses: " << stats.misses
+              << ", writes: " << stats.writes
+              << ", time: " << stats.seconds * 1e3 << " ms\n";
+}
+
+TokenCache::Entry TokenCache::encode(const Token &tok, const char *base)
+{
+    Entry entry = {};
+    entry.offset = tok.text - base;
+    memcpy(&entry.value, &tok.sym, sizeof(entry.value));
+    entry.length = tok.length;
+    entry.type = static_cast<uint8_t>(tok.type);
+    return entry;
+}
+
+Token TokenCache::decode(const Entry &entry, const char *base)
+{
+    Token tok;
+    tok.text = base + entry.offset;
+    memcpy(&tok.sym, &entry.value, sizeof(entry.value));
+    tok.length = entry.length;
+    tok.type = static_cast<Token::TokenType>(entry.type);
+    return tok;
+}
+}
@@ -0,0 +1,129 @@
+#ifndef __TOKEN_CACHE_HH__
+#define __TOKEN_CACHE_HH__
+
+#include "lexer/interner.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Frontend
+{
+struct Token;
+
+/*
+ * TokenCache - binary token stream of a source file, keyed by a hash of
+ * its content.
+ *
+ * A cache file lives at <dir>/<content hash>.tok and holds, after a
+ * fixed header:
+ *
+ *   Entry[num_tokens]     - type, value and source offset of every token
+ *   uint32_t[num_lines]   - the lexer's line table
+ *   StrEntry[num_strings] - interned identifiers in symbol order, as
+ *                           (offset, length) into the source
+ *
+ * Nothing in the file is a pointer, so it is mapped read-only as is and
+ * tokens are rebuilt against the source buffer (base + offset) while
+ * the lexer hands them out. Re-interning the strings in order yields the
+ * same symbol ids the tokens carry.
+ * */
+class TokenCache
+{
+  public:
+    // Bump whenever the lexer output or the layout below changes
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t entry_size;
+        uint64_t content_hash;
+        uint64_t source_size;
+        uint64_t num_tokens;
+        uint64_t num_lines;
+        uint64_t num_strings;
+    };
+
+    struct Entry
+    {
+        uint32_t offset;
+        // raw bits of the symbol / int / float
+        uint32_t value;
+        uint16_t length;
+        uint8_t type;
+        uint8_t pad;
+    };
+    static_assert(sizeof(Entry) == 12);
+
+    struct StrEntry
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // Process-wide counters, reported by the drivers
+    struct Stats
+    {
+        unsigned hits = 0;
+        unsigned misses = 0;
+        unsigned writes = 0;
+        // time spent loading or lexing + writing
+        double seconds = 0;
+    };
+    static Stats stats;
+
+    // Prints the counters to stderr
+    static void reportStats();
+
+  protected:
+    const char *map = nullptr;
+    size_t map_size = 0;
+
+    const Header *header = nullptr;
+    const Entry *entries = nullptr;
+    const uint32_t *lines = nullptr;
+    const StrEntry *strs = nullptr;
+
+  public:
+    TokenCache() {}
+    ~TokenCache();
+
+    TokenCache(const TokenCache&) = delete;
+    TokenCache& operator=(const TokenCache&) = delete;
+
+    static uint64_t hashContent(std::string_view content);
+
+    static std::string path(const char *dir, uint64_t content_hash);
+
+    // Maps the cache file, false if it is missing or does not belong to
+    // this content (hash, size, or format version differ).
+    bool load(const std::string &fn, uint64_t content_hash,
+              size_t source_size);
+
+    // Writes a cache file for source. Tokens come from several vectors
+    // (the lexer's chunks) and are concatenated in order. The file is
+    // written under a temporary name and renamed, so concurrent builds
+    // never see a partial file.
+    static bool store(const std::string &fn, uint64_t content_hash,
+                      std::string_view source,
+                      const std::vector<const std::vector<Token>*> &toks,
+                      const std::vector<uint32_t> &line_starts,
+                      const StringInterner &strings);
+
+    size_t numTokens() const { return header->num_tokens; }
+    size_t numLines() const { return header->num_lines; }
+    size_t numStrings() const { return header->num_strings; }
+
+    const Entry *getEntries() const { return entries; }
+    const uint32_t *getLines() const { return lines; }
+    const StrEntry *getStrings() const { return strs; }
+
+    static Entry encode(const Token &tok, const char *base);
+    static Token decode(const Entry &entry, const char *base);
+};
+}
+
+#endif
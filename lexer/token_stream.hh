@@ -0,0 +1,145 @@
+#ifndef __TOKEN_STREAM_HH__
+#define __TOKEN_STREAM_HH__
+
+#include "lexer/lexer.hh"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * TokenStream - fixed-capacity ring buffer of tokens over a Lexer.
+ *
+ * peek(0) is the current token, peek(k) looks k tokens ahead. Whenever
+ * the lookahead runs short, the free part of the ring is refilled from
+ * the lexer in one go. Past the end of the file every peek returns EOF.
+ *
+ * A stream can also run over a slice of tokens lexed earlier (e.g., one
+ * function), the slice then plays the part of the whole file.
+ * */
+class TokenStream
+{
+  public:
+    // Ring size, must be a power of two
+    static constexpr size_t CAPACITY = 256;
+    // peek(k) requires k < MAX_LOOKAHEAD
+    static constexpr size_t MAX_LOOKAHEAD = 16;
+
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0);
+    static_assert(MAX_LOOKAHEAD <= CAPACITY);
+
+  protected:
+    Lexer *lexer = nullptr;
+
+    // Slice of tokens to read instead of the lexer
+    const Token *next = nullptr;
+    const Token *last = nullptr;
+
+    std::array<Token, CAPACITY> ring;
+    // Free-running positions, the ring index is pos & (CAPACITY - 1)
+    // head - the current token
+    // tail - one past the last buffered token
+    size_t head = 0;
+    size_t tail = 0;
+
+    bool lexer_done = false;
+
+  public:
+    TokenStream(Lexer *_lexer) : lexer(_lexer) { refill(); }
+
+    TokenStream(const Token *begin, const Token *end)
+        : next(begin), last(end) { refill(); }
+
+    // Restarts the stream on another slice, in place
+    void reset(const Token *begin, const Token *end)
+    {
+        lexer = nullptr;
+        next = begin;
+        last = end;
+        head = tail = 0;
+        refill();
+    }
+
+    Token &peek(size_t k = 0)
+    {
+        assert(k < MAX_LOOKAHEAD);
+        if (tail - head <= k) refill();
+        return ring[(head + k) & (CAPACITY - 1)];
+    }
+
+    void advance()
+    {
+        head++;
+        if (head == tail) refill();
+    }
+
+    // Appends every token left in the stream to out, the stream is at
+    // EOF afterwards
+    void drain(std::vector<Token> &out)
+    {
+        for (; head != tail; head++)
+        {
+            auto &tok = ring[head & (CAPACITY - 1)];
+            if (tok.type == Token::TokenType::TOKEN_EOF) break;
+            out.push_back(tok);
+        }
+
+        if (lexer == nullptr)
+        {
+            out.insert(out.end(), next, last);
+            next = last;
+        }
+        else
+        {
+            static constexpr size_t BATCH = 1 << 14;
+            while (!lexer_done)
+            {
+                size_t size = out.size();
+                out.resize(size + BATCH);
+                size_t got = lexer->getTokens(out.data() + size, BATCH);
+                out.resize(size + got);
+                lexer_done = (got < BATCH);
+            }
+        }
+
+        head = tail;
+        refill();
+    }
+
+  protected:
+    void refill()
+    {
+        while (tail - head < CAPACITY)
+        {
+            // contiguous free slots up to the end of the ring
+            size_t idx = tail & (CAPACITY - 1);
+            size_t want = std::min(CAPACITY - (tail - head),
+                                   CAPACITY - idx);
+
+            size_t got = 0;
+            if (lexer == nullptr)
+            {
+                got = std::min(want, size_t(last - next));
+                std::copy_n(next, got, &ring[idx]);
+                next += got;
+            }
+            else if (!lexer_done)
+            {
+                got = lexer->getTokens(&ring[idx], want);
+                lexer_done = (got < want);
+            }
+
+            // pad with EOF past the end of the file
+            for (size_t i = got; i < want; i++)
+                ring[idx + i] = Token(Token::TokenType::TOKEN_EOF);
+
+            tail += want;
+        }
+    }
+};
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef __ARENA_HH__
+#define __ARENA_HH__
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * Arena - bump-pointer allocator for the AST.
+ *
+ * Nodes are carved out of large blocks and never freed one by one: the
+ * blocks are released together when the arena (i.e., the Program) goes
+ * away. No destructor runs for anything allocated here, so make() only
+ * accepts trivially destructible types; lists of children are stored as
+ * ArenaList (pointer + count) instead of std::vector.
+ * */
+class Arena
+{
+  protected:
+    static constexpr size_t BLOCK_SIZE = 256 << 10;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *cur = nullptr;
+    char *end = nullptr;
+
+    // bytes handed out, for statistics
+    size_t used = 0;
+
+  public:
+    Arena() {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    Arena(Arena &&other) { *this = std::move(other); }
+    Arena& operator=(Arena &&other)
+    {
+        blocks = std::move(other.blocks);
+        cur = std::exchange(other.cur, nullptr);
+        end = std::exchange(other.end, nullptr);
+        used = std::exchange(other.used, 0);
+        return *this;
+    }
+
+    void *allocate(size_t size, size_t align)
+    {
+        // new char[] memory is aligned for any fundamental type
+        assert(align <= alignof(std::max_align_t));
+
+        uintptr_t p = (reinterpret_cast<uintptr_t>(cur) + align - 1) &
+                      ~uintptr_t(align - 1);
+        if (cur == nullptr || p + size > reinterpret_cast<uintptr_t>(end))
+            return allocateSlow(size);
+
+        cur = reinterpret_cast<char*>(p + size);
+        used += size;
+        return reinterpret_cast<void*>(p);
+    }
+
+    template<typename T, typename... Args>
+    T *make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>,
+                      "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+    }
+
+    size_t bytesUsed() const { return used; }
+
+    // Frees everything allocated so far. The current block is kept for
+    // the next allocations, so an arena reset after every small batch of
+    // nodes never goes back to the allocator.
+    void reset()
+    {
+        used = 0;
+
+        // Only blocks of their own so far
+        if (cur == nullptr)
+        {
+            blocks.clear();
+            return;
+        }
+
+        // the current block is the last one (see allocateSlow)
+        std::swap(blocks.front(), blocks.back());
+        blocks.resize(1);
+        cur = blocks.front().get();
+        end = cur + BLOCK_SIZE;
+    }
+
+  protected:
+    void *allocateSlow(size_t size)
+    {
+        used += size;
+
+        // Big requests get a block of their own so that the current
+        // block keeps its free space
+        if (size > BLOCK_SIZE / 4)
+        {
+            blocks.emplace_back(new char[size]);
+            char *mem = blocks.back().get();
+            // keep the current block at the back
+            if (blocks.size() > 1)
+                std::swap(blocks[blocks.size() - 1],
+                          blocks[blocks.size() - 2]);
+            return mem;
+        }
+
+        blocks.emplace_back(new char[BLOCK_SIZE]);
+        cur = blocks.back().get() + size;
+        end = blocks.back().get() + BLOCK_SIZE;
+        return blocks.back().get();
+    }
+};
+
+/*
+ * ArenaList - fixed list of T living in an Arena.
+ *
+ * The parser collects children in a std::vector while a block is being
+ * parsed and copies them into the arena once, when the node is built.
+ * */
+template<typename T>
+class ArenaList
+{
+    static_assert(std::is_trivially_copyable_v<T> &&
+                  std::is_trivially_destructible_v<T>,
+                  "arena list elements are never destroyed");
+
+  protected:
+    T *data = nullptr;
+    uint32_t count = 0;
+
+  public:
+    ArenaList() {}
+
+    ArenaList(Arena &arena, const std::vector<T> &items)
+    {
+        if (items.empty()) return;
+
+        data = static_cast<T*>(arena.allocate(sizeof(T) * items.size(),
+                                              alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), data);
+        count = items.size();
+    }
+
+    // n uninitialized items, the caller assigns every one of them
+    ArenaList(Arena &arena, size_t n)
+    {
+        if (n == 0) return;
+
+        data = static_cast<T*>(arena.allocate(sizeof(T) * n, alignof(T)));
+        count = n;
+    }
+
+    T *begin() const { return data; }
+    T *end() const { return data + count; }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    T &operator[](size_t i) const { return data[i]; }
+    T &back() const { return data[count - 1]; }
+};
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include "parser/ast_cache.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <type_traits>
+#include <unordered_map>
+
+namespace Frontend
+{
+static constexpr char CACHE_MAGIC[8] = {'F', 'E', 'A', 'S', 'T', 'C', 'A', 'C'};
+
+AstCache::Stats AstCache::stats;
+
+AstCache::~AstCache()
+{
+    if (map != nullptr) munmap(const_cast<char*>(map), map_size);
+}
+
+std::string AstCache::path(const char *dir, uint64_t content_hash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.ast",
+             static_cast<unsigned long long>(content_hash));
+    return std::string(dir) + name;
+}
+
+// Element size of every section
+static void sectionSizes(size_t (&sizes)[AstCache::NUM_SECTIONS])
+{
+    sizes[AstCache::TOKENS] = sizeof(TokenCache::Entry);
+
+    FlatAst empty;
+    unsigned i = AstCache::FLAT_FIRST;
+    empty.forEachArray([&](auto &vec)
+    {
+        sizes[i++] = sizeof(typename std::decay_t<decltype(vec)>::value_type);
+    });
+
+    sizes[AstCache::FUNC_STARTS] = sizeof(uint32_t);
+    sizes[AstCache::STRINGS] = sizeof(AstCache::StrEntry);
+    sizes[AstCache::BLOB] = 1;
+}
+
+uint64_t AstCache::formatId()
+{
+    static const uint64_t id = []()
+    {
+        size_t sizes[NUM_SECTIONS];
+        sectionSizes(sizes);
+
+        std::string key = "FlatAst " + std::to_string(FORMAT_VERSION) +
+                          " " + std::to_string(FlatAst::NUM_ARRAYS);
+        for (auto size : sizes) key += " " + std::to_string(size);
+        return TokenCache::hashContent(key);
+    }();
+    return id;
+}
+
+bool AstCache::load(const std::string &fn, uint64_t content_hash,
+                    std::string_view _source)
+{
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+
+    // All of it is read right away, fault it in at once
+    void *addr = mmap(nullptr, st.st_size, PROT_READ,
+                      MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    map = static_cast<const char*>(addr);
+    map_size = st.st_size;
+    header = reinterpret_cast<const Header*>(map);
+
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header->version != FORMAT_VERSION ||
+        header->entry_size != sizeof(TokenCache::Entry) ||
+        header->format_id != formatId() ||
+        header->content_hash != content_hash ||
+        header->source_size != _source.size())
+        return false;
+
+    size_t sizes[NUM_SECTIONS];
+    sectionSizes(sizes);
+
+    size_t offset = sizeof(Header);
+    for (unsigned i = 0; i < NUM_SECTIONS; i++)
+    {
+        sections[i] = map + offset;
+        offset += header->counts[i] * sizes[i];
+        if (offset > map_size) return false;
+    }
+    if (offset != map_size) return false;
+
+    source = _source.data();
+    return true;
+}
+
+bool AstCache::store(const std::string &fn, uint64_t content_hash,
+                     std::string_view source,
+                     FlatAst &ast,
+                     const std::vector<const char*> &func_starts,
+                     const StringInterner &strings)
+{
+    // Text outside the source goes into the blob, once per address
+    std::string blob;
+    std::unordered_map<const char*, uint32_t> in_blob;
+    std::less<const char*> before;
+    auto textOffset = [&](const char *text, size_t length) -> uint64_t
+    {
+        if (!before(text, source.data()) &&
+            !before(source.data() + source.size(), text + length))
+            return text - source.data();
+
+        auto [iter, inserted] = in_blob.try_emplace(text, blob.size());
+        if (inserted) blob.append(text, length);
+        return source.size() + iter->second;
+    };
+
+    std::vector<TokenCache::Entry> toks;
+    toks.reserve(ast.toks.size());
+    for (auto &tok : ast.toks)
+    {
+        auto entry = TokenCache::encode(tok, source.data());
+        entry.offset = textOffset(tok.text, tok.length);
+        toks.push_back(entry);
+    }
+
+    std::vector<uint32_t> starts;
+    starts.reserve(func_starts.size());
+    for (auto start : func_starts)
+        starts.push_back(start - source.data());
+
+    std::vector<StrEntry> strs(strings.size());
+    for (StringInterner::Symbol sym = 0; sym < strings.size(); sym++)
+    {
+        auto str = strings.str(sym);
+        strs[sym].offset = textOffset(str.data(), str.size());
+        strs[sym].length = str.size();
+    }
+
+    // Offsets are 32 bits
+    if (source.size() + blob.size() > UINT32_MAX) return false;
+
+    Header header = {};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = FORMAT_VERSION;
+    header.entry_size = sizeof(TokenCache::Entry);
+    header.format_id = formatId();
+    header.content_hash = content_hash;
+    header.source_size = source.size();
+
+    std::string tmp_fn = fn + ".tmp." + std::to_string(getpid());
+    FILE *out = fopen(tmp_fn.c_str(), "wb");
+    if (out == nullptr) return false;
+
+    // header first (counts filled in below), then the sections in order
+    bool ok = fseek(out, sizeof(header), SEEK_SET) == 0;
+    unsigned section = TOKENS;
+    auto write = [&](const void *data, size_t size, size_t count)
+    {
+        header.counts[section++] = count;
+        ok = ok && fwrite(data, size, count, out) == count;
+    };
+
+    write(toks.data(), sizeof(toks[0]), toks.size());
+    ast.forEachArray([&](auto &vec)
+    {
+        write(vec.data(), sizeof(vec[0]), vec.size());
+    });
+    write(starts.data(), sizeof(uint32_t), starts.size());
+    write(strs.data(), sizeof(StrEntry), strs.size());
+    write(blob.data(), 1, blob.size());
+    assert(section == NUM_SECTIONS);
+
+    ok = ok && fseek(out, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&header, sizeof(header), 1, out) == 1;
+
+    ok = (fclose(out) == 0) && ok;
+    ok = ok && rename(tmp_fn.c_str(), fn.c_str()) == 0;
+    if (!ok) unlink(tmp_fn.c_str());
+
+    return ok;
+}
+
+void AstCache::fill(FlatAst &ast)
+{
+    auto entries = reinterpret_cast<const TokenCache::Entry*>(
+        sections[TOKENS]);
+    size_t num_toks = header->counts[TOKENS];
+    ast.toks.resize(num_toks);
+    for (size_t i = 0; i < num_toks; i++)
+    {
+        ast.toks[i] = TokenCache::decode(entries[i], source);
+        ast.toks[i].text = text(entries[i].offset);
+    }
+
+    // The other arrays are used in place
+    unsigned section = FLAT_FIRST;
+    ast.forEachArray([&](auto &vec)
+    {
+        using T = typename std::decay_t<decltype(vec)>::value_type;
+        vec.borrow(reinterpret_cast<const T*>(sections[section]),
+                   header->counts[section]);
+        section++;
+    });
+}
+
+void AstCache::reportStats()
+{
+    std::cerr << "[AstCache] hits: " << stats.hits
+              << ", misses: " << stats.misses
+              << ", writes: " << stats.writes
+              << ", time: " << stats.seconds * 1e3 << " ms\n";
+}
+}
@@ -0,0 +1,158 @@
+#ifndef __AST_CACHE_HH__
+#define __AST_CACHE_HH__
+
+#include "lexer/token_cache.hh"
+#include "parser/flat_ast.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * AstCache - binary AST of a source file, keyed by a hash of its content
+ * and by the build of the compiler that wrote it.
+ *
+ * A cache file lives at <dir>/<content hash>.ast and holds, after a
+ * fixed header, the arrays of a FlatAst followed by what is needed to
+ * rebuild the parser state around it:
+ *
+ *   TokenCache::Entry[]   - tokens referred to by the AST
+ *   FlatAst arrays        - in FlatAst::forEachArray() order
+ *   uint32_t[num_funcs]   - source offset of every function's first token
+ *   StrEntry[num_strings] - interned identifiers in symbol order
+ *   char[blob_size]       - text that is not in the source
+ *
+ * Text is addressed by one offset: below source_size it is in the
+ * source, past it in the blob (names of built-ins, tokens made up by
+ * the parser). Nothing in the file is a pointer, so it is mapped
+ * read-only and a FlatAst uses the arrays in place, only the tokens are
+ * rebuilt against the source. The interned strings may point into the
+ * blob, so the cache must outlive the interner it was loaded into.
+ *
+ * The format id covers FORMAT_VERSION and the element size of every
+ * section, not the build: any build of the same format reuses the file,
+ * so pre-parsed modules can be shipped with the sources. Parse options
+ * are not part of the key, so Parser::loadAst() checks the calls of a
+ * loaded AST again and parses the source if one does not resolve.
+ * */
+class AstCache
+{
+  public:
+    // Bump whenever the layout below, the FlatAst nodes or the AST the
+    // parser builds for a given source change
+    static constexpr uint32_t FORMAT_VERSION = 2;
+
+    // Arrays in the file, in order
+    enum Section : uint32_t
+    {
+        TOKENS,
+        FLAT_FIRST,
+        // one per array of FlatAst::forEachArray()
+        FLAT_LAST = FLAT_FIRST + FlatAst::NUM_ARRAYS - 1,
+        FUNC_STARTS,
+        STRINGS,
+        BLOB,
+        NUM_SECTIONS
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t entry_size;
+        uint64_t format_id;
+        uint64_t content_hash;
+        uint64_t source_size;
+        // number of elements in every section
+        uint64_t counts[NUM_SECTIONS];
+    };
+
+    struct StrEntry
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // Process-wide counters, reported by the drivers
+    struct Stats
+    {
+        unsigned hits = 0;
+        unsigned misses = 0;
+        unsigned writes = 0;
+        // time spent loading, or converting + writing
+        double seconds = 0;
+    };
+    static Stats stats;
+
+    // Prints the counters to stderr
+    static void reportStats();
+
+  protected:
+    const char *map = nullptr;
+    size_t map_size = 0;
+
+    const Header *header = nullptr;
+    // start of every section in the mapping
+    const char *sections[NUM_SECTIONS] = {};
+
+    // Resolved against at load time
+    const char *source = nullptr;
+
+  public:
+    AstCache() {}
+    ~AstCache();
+
+    AstCache(const AstCache&) = delete;
+    AstCache& operator=(const AstCache&) = delete;
+
+    // Hash of FORMAT_VERSION and the section element sizes
+    static uint64_t formatId();
+
+    static std::string path(const char *dir, uint64_t content_hash);
+
+    // Maps the cache file, false if it is missing or does not belong to
+    // this source (hash, size or format differ).
+    bool load(const std::string &fn, uint64_t content_hash,
+              std::string_view _source);
+
+    // Writes a cache file for the AST of source under a temporary name
+    // and renames it, so concurrent builds never see a partial file.
+    static bool store(const std::string &fn, uint64_t content_hash,
+                      std::string_view source,
+                      FlatAst &ast,
+                      const std::vector<const char*> &func_starts,
+                      const StringInterner &strings);
+
+    // Points ast at the arrays in the mapping (only the tokens are
+    // copied), the cache must outlive it
+    void fill(FlatAst &ast);
+
+    size_t numFuncs() const { return header->counts[FUNC_STARTS]; }
+    size_t numStrings() const { return header->counts[STRINGS]; }
+
+    const char *funcStart(size_t i) const
+    {
+        auto offsets = reinterpret_cast<const uint32_t*>(
+            sections[FUNC_STARTS]);
+        return source + offsets[i];
+    }
+
+    std::string_view string(size_t i) const
+    {
+        auto strs = reinterpret_cast<const StrEntry*>(sections[STRINGS]);
+        return std::string_view(text(strs[i].offset), strs[i].length);
+    }
+
+  protected:
+    const char *text(uint32_t offset) const
+    {
+        if (offset < header->source_size) return source + offset;
+        return sections[BLOB] + (offset - header->source_size);
+    }
+};
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __DIAGNOSTICS_HH__
+#define __DIAGNOSTICS_HH__
+
+#include "lexer/lexer.hh"
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * Diagnostics - errors collected while parsing.
+ *
+ * The parser does not stop at the first error: it records the error
+ * here, skips to a point where parsing can safely go on (the end of the
+ * statement, of the block, or the next function) and keeps going, so
+ * that one run reports every error in the file. Each error keeps a copy
+ * of its source line, printed with a caret under the column.
+ * */
+class Diagnostics
+{
+  public:
+    // Errors past this many are counted but not printed
+    static constexpr size_t MAX_ERRORS = 100;
+
+  protected:
+    struct Error
+    {
+        SourceLocation loc;
+        std::string line;
+        std::string msg;
+    };
+
+    std::string file_name;
+    std::vector<Error> errors;
+    size_t num_errors = 0;
+
+  public:
+    void setFileName(std::string_view name) { file_name = name; }
+
+    void error(SourceLocation loc, std::string_view line, std::string msg)
+    {
+        if (num_errors++ >= MAX_ERRORS) return;
+        errors.push_back({loc, std::string(line), std::move(msg)});
+    }
+
+    // Adds the errors of other after the ones here
+    void append(const Diagnostics &other)
+    {
+        for (auto &err : other.errors)
+        {
+            if (errors.size() == MAX_ERRORS) break;
+            errors.push_back(err);
+        }
+        num_errors += other.num_errors;
+    }
+
+    bool hasErrors() const { return num_errors != 0; }
+    size_t numErrors() const { return num_errors; }
+
+    void clear()
+    {
+        errors.clear();
+        num_errors = 0;
+    }
+
+    // [Error] file:line:col: msg
+    // [Line] the source line
+    //          ^
+    void report(std::ostream &out) const
+    {
+        for (auto &err : errors)
+        {
+            out << "[Error] " << file_name;
+            if (err.loc.line != 0)
+                out << ":" << err.loc.line << ":" << err.loc.col;
+            out << ": " << err.msg << "\n";
+
+            if (err.line.empty()) continue;
+            out << "[Line] " << err.line << "\n";
+
+            // keep tabs so that the caret lines up
+            std::string caret(7, ' ');
+            for (size_t i = 0; i + 1 < err.loc.col && i < err.line.size();
+                 i++)
+                caret += (err.line[i] == '\t') ? '\t' : ' ';
+            out << caret << "^\n";
+        }
+
+        out << "[Error] " << num_errors
+            << (num_errors == 1 ? " error" : " errors") << " in "
+            << file_name;
+        if (num_errors > errors.size())
+            out << " (first " << errors.size() << " shown)";
+        out << "\n";
+    }
+};
+}
+
+#endif
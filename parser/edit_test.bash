@@ -0,0 +1,109 @@
+# Checks incremental reparsing (--edit) against a full parse of the
+# edited text: same exit code, same AST and same errors.
+# Usage: bash edit_test.bash [path to the parser binary]
+PARSER=${1:-./parser}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+cat > $DIR/base.txt <<'EOF'
+int foo(int x)
+{
+    return x + 1;
+}
+
+int bar(int y)
+{
+    return foo(y) * 2;
+}
+
+int main()
+{
+    int a = foo(3);
+    int b = bar(a);
+    printVarInt(b);
+    return 0;
+}
+EOF
+SRC=$(<$DIR/base.txt)
+
+FAILS=0
+
+# check NAME EXPECTED_RC OLD_TEXT NEW_TEXT
+# replaces the first OLD_TEXT of the source with NEW_TEXT
+check()
+{
+    local prefix=${SRC%%"$3"*}
+    local offset=${#prefix}
+    printf '%s\n' "${SRC:0:$offset}$4${SRC:$offset+${#3}}" > $DIR/edited.txt
+
+    for mode in "" "--parse-threads 2"; do
+        $PARSER $DIR/base.txt $mode --edit $offset ${#3} "$4" \
+            > $DIR/inc.out 2> $DIR/inc.err
+        local inc_rc=$?
+        $PARSER $DIR/edited.txt $mode > $DIR/full.out 2> $DIR/full.err
+        local full_rc=$?
+
+        grep -v '^\[Edit\]' $DIR/inc.err | sed "s|$DIR/base.txt|FILE|" \
+            > $DIR/inc.err2
+        sed "s|$DIR/edited.txt|FILE|" $DIR/full.err > $DIR/full.err2
+
+        if [ $inc_rc != $2 ] || [ $full_rc != $2 ] ||
+           ! cmp -s $DIR/inc.out $DIR/full.out ||
+           ! cmp -s $DIR/inc.err2 $DIR/full.err2; then
+            echo "FAIL $1 $mode (rc: incremental $inc_rc, full $full_rc)"
+            diff $DIR/inc.err2 $DIR/full.err2
+            FAILS=$((FAILS + 1))
+        else
+            echo "ok   $1 $mode"
+        fi
+    done
+}
+
+# Body only, the callers are not reparsed
+check body 0 "return x + 1;" "return x + 2;"
+
+# Signature kept, argument renamed
+check argument 0 $'int foo(int x)\n{\n    return x + 1;' \
+                 $'int foo(int z)\n{\n    return z + 1;'
+
+# Callers of a renamed function must fail
+check rename 1 "int foo" "int baz"
+
+# Callers of a function whose types changed must be checked again
+check signature 1 $'int foo(int x)\n{\n    return x + 1;' \
+                  $'float foo(float x)\n{\n    return x + 1.0;'
+
+# One more argument
+check arguments 1 "int foo(int x)" "int foo(int x, int w)"
+
+# Callers of a deleted function must fail
+check delete 1 $'int foo(int x)\n{\n    return x + 1;\n}\n\n' ""
+
+# A call may come before the callee's definition, in both modes
+cat > $DIR/base.txt <<'EOF'
+int main()
+{
+    int a = later(3);
+    printVarInt(a);
+    return 0;
+}
+
+int later(int x)
+{
+    return x * 2;
+}
+
+int last(int y)
+{
+    return later(y) + 1;
+}
+EOF
+SRC=$(<$DIR/base.txt)
+
+check forward 0 "return x * 2;" "return x * 3;"
+
+# The region has errors too, the caller before it is checked all the same
+check "forward signature" 1 "int later(int x)" "float later(float x)"
+
+[ $FAILS = 0 ] && echo "ALL OK"
+exit $FAILS
@@ -0,0 +1,172 @@
+#include "parser/parser.hh"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace Frontend;
+
+// Expression parsing benchmark: parses generated programs made of wide
+// expressions (many operands at every precedence level) and deep ones
+// (nested parentheses, right-nested operands, unary minus chains), and
+// reports the best parse time of a few runs for each shape.
+//
+// Usage: ./expr_bench [scale]
+//
+// Only the parser of the tree it is built in is timed. To compare with
+// the recursive descent expression parser that the Pratt parser
+// replaced, build this same file against the commit before the Pratt
+// parser and run both binaries:
+//
+//   git worktree add /tmp/before <Pratt parser commit>^
+//   clang++ -O3 -std=c++17 -pthread -I /tmp/before \
+//       /tmp/before/lexer/{lexer,source,simd,token_cache}.cc \
+//       /tmp/before/parser/{parser,flat_ast}.cc \
+//       parser/expr_bench.cc -o expr_bench_before
+
+// f(a, b) { int v = 0; v = <expr>; ... return v; }
+static std::string makeProgram(size_t num_funcs, size_t num_statements,
+                               std::string (*expr)(size_t))
+{
+    std::string src;
+    for (size_t f = 0; f < num_funcs; f++)
+    {
+        src += "int f" + std::to_string(f) + "(int a, int b)\n{\n";
+        src += "    int v = 0;\n";
+        for (size_t s = 0; s < num_statements; s++)
+            src += "    v = " + expr(s) + ";\n";
+        src += "    return v;\n}\n";
+    }
+    return src;
+}
+
+// Operand i of the expression of statement seed
+static const char *operand(size_t seed, size_t i)
+{
+    static const char *vals[] = {"a", "b", "v", "3", "7"};
+    return vals[(seed * 7 + i) % 5];
+}
+
+// a + b * 3 - v / 2 + ... , 32 operands
+static std::string wideExpr(size_t seed)
+{
+    static const char *oprs[] = {" + ", " * ", " - ", " / "};
+    std::string expr = "a";
+    for (size_t i = 1; i < 32; i++)
+    {
+        expr += oprs[(seed + i) % 4];
+        expr += operand(seed, i);
+    }
+    return expr;
+}
+
+// a + b - 3 + ... , 2000 operands at one level
+static std::string chainExpr(size_t seed)
+{
+    std::string expr = operand(seed, 0);
+    for (size_t i = 1; i < 2000; i++)
+    {
+        expr += ((seed + i) % 2) ? " + " : " - ";
+        expr += operand(seed, i);
+    }
+    return expr;
+}
+
+// ((((a + 1) * 2 + b) * 2 + 1) ...), 200 levels
+static std::string parenExpr(size_t seed)
+{
+    std::string expr = operand(seed, 0);
+    for (size_t i = 1; i <= 200; i++)
+        expr = "(" + expr + " + " + operand(seed, i) + ") * 2";
+    return expr;
+}
+
+// a - (b - (3 - ( ... ))), 200 levels
+static std::string rightExpr(size_t seed)
+{
+    std::string expr = operand(seed, 0);
+    for (size_t i = 1; i <= 200; i++)
+        expr = std::string(operand(seed, i)) + " - (" + expr + ")";
+    return expr;
+}
+
+// - - - ... - a * b, 100 levels
+static std::string unaryExpr(size_t seed)
+{
+    std::string expr;
+    for (size_t i = 0; i < 100; i++) expr += "- ";
+    return expr + operand(seed, 0) + " * " + operand(seed, 1);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t scale = (argc > 1) ? std::stoul(argv[1]) : 1;
+
+    struct Shape
+    {
+        const char *name;
+        size_t num_funcs;
+        size_t num_statements;
+        std::string (*expr)(size_t);
+    };
+    std::vector<Shape> shapes =
+    {
+        {"wide", 2000 * scale, 16, wideExpr},
+        {"chain", 100 * scale, 4, chainExpr},
+        {"parens", 200 * scale, 8, parenExpr},
+        {"right", 200 * scale, 8, rightExpr},
+        {"unary", 2000 * scale, 8, unaryExpr},
+    };
+
+    char fn[] = "/tmp/expr_bench_XXXXXX";
+    int fd = mkstemp(fn);
+    if (fd < 0)
+    {
+        std::cerr << "[Error] expr_bench: cannot create a temporary file\n";
+        exit(1);
+    }
+    close(fd);
+
+    using Clock = std::chrono::steady_clock;
+
+    std::cout << std::left << std::setw(8) << "shape"
+              << std::right << std::setw(12) << "bytes"
+              << std::setw(12) << "best ms"
+              << std::setw(10) << "MB/s" << "\n";
+
+    for (auto &shape : shapes)
+    {
+        std::string src = makeProgram(shape.num_funcs,
+                                      shape.num_statements,
+                                      shape.expr);
+        FILE *out = fopen(fn, "wb");
+        fwrite(src.data(), 1, src.size(), out);
+        fclose(out);
+
+        double best = 1e30;
+        for (int run = 0; run < 5; run++)
+        {
+            auto start = Clock::now();
+            {
+                Parser parser(fn);
+            }
+            std::chrono::duration<double, std::milli> elapsed =
+                Clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+
+        std::cout << std::left << std::setw(8) << shape.name
+                  << std::right << std::setw(12) << src.size()
+                  << std::setw(12) << std::fixed << std::setprecision(2)
+                  << best
+                  << std::setw(10) << std::setprecision(1)
+                  << src.size() / best / 1e3 << "\n";
+    }
+
+    unlink(fn);
+}
@@ -0,0 +1,597 @@
+#include "parser/flat_ast.hh"
+
+namespace Frontend
+{
+FlatAst::FlatAst(Program &program)
+{
+    auto &statements = program.getStatements();
+    funcs.reserve(statements.size());
+    for (auto statement : statements)
+        funcs.push_back(addStmt(statement));
+}
+
+size_t FlatAst::bytesUsed() const
+{
+    auto bytes = [](auto &vec) { return vec.size() * sizeof(vec[0]); };
+    return bytes(toks) +
+           bytes(expr_kind) + bytes(expr_tok) +
+           bytes(expr_lhs) + bytes(expr_rhs) +
+           bytes(cond_opr) + bytes(cond_type) +
+           bytes(cond_lhs) + bytes(cond_rhs) +
+           bytes(stmt_kind) + bytes(stmt_tok) + bytes(stmt_a) +
+           bytes(stmt_b) + bytes(stmt_c) + bytes(stmt_d) +
+           bytes(block_stmts) + bytes(block_vars) +
+           bytes(extra) + bytes(funcs);
+}
+
+/****************************** Conversion *******************************/
+FlatAst::Index FlatAst::addToken(Token &tok)
+{
+    toks.push_back(tok);
+    return toks.size() - 1;
+}
+
+FlatAst::Index FlatAst::addList(const std::vector<Index> &items)
+{
+    Index offset = extra.size();
+    extra.push_back(items.size());
+    for (auto item : items) extra.push_back(item);
+    return offset;
+}
+
+FlatAst::Index FlatAst::newExpr(ExprKind kind, Index tok,
+                                Index lhs, Index rhs)
+{
+    expr_kind.push_back(kind);
+    expr_tok.push_back(tok);
+    expr_lhs.push_back(lhs);
+    expr_rhs.push_back(rhs);
+    return expr_kind.size() - 1;
+}
+
+FlatAst::Index FlatAst::newStmt(StmtKind kind, Index tok,
+                                Index a, Index b, Index c, Index d)
+{
+    stmt_kind.push_back(kind);
+    stmt_tok.push_back(tok);
+    stmt_a.push_back(a);
+    stmt_b.push_back(b);
+    stmt_c.push_back(c);
+    stmt_d.push_back(d);
+    return stmt_kind.size() - 1;
+}
+
+// Children are added before their parents
+FlatAst::Index FlatAst::addExpr(Expression *expr)
+{
+    if (expr->isExprLiteral())
+    {
+        auto lit = static_cast<LiteralExpression*>(expr);
+        return newExpr(ExprKind::LITERAL, addToken(lit->getToken()),
+                       NONE, NONE);
+    }
+    else if (expr->isExprArith())
+    {
+        auto arith = static_cast<ArithExpression*>(expr);
+        Index lhs = addExpr(arith->getLeft());
+        Index rhs = addExpr(arith->getRight());
+        return newExpr(expr->getType(), NONE, lhs, rhs);
+    }
+    else if (expr->isExprArray())
+    {
+        auto array = static_cast<ArrayExpression*>(expr);
+        Index num_ele = addExpr(array->getNumElements());
+        std::vector<Index> eles;
+        for (auto ele : array->getElements()) eles.push_back(addExpr(ele));
+        return newExpr(ExprKind::ARRAY, NONE, num_ele, addList(eles));
+    }
+    else if (expr->isExprIndex())
+    {
+        auto index = static_cast<IndexExpression*>(expr);
+        Index idx = addExpr(index->getIndex());
+        return newExpr(ExprKind::INDEX, addToken(index->getIdenToken()),
+                       idx, NONE);
+    }
+    else
+    {
+        assert(expr->isExprCall());
+        auto call = static_cast<CallExpression*>(expr);
+        std::vector<Index> args;
+        for (auto arg : call->getArgs()) args.push_back(addExpr(arg));
+        return newExpr(ExprKind::CALL, addToken(call->getCallFuncToken()),
+                       NONE, addList(args));
+    }
+}
+
+FlatAst::Index FlatAst::addCond(Condition *cond)
+{
+    Index lhs = addExpr(cond->getLeft());
+    Index rhs = addExpr(cond->getRight());
+
+    cond_opr.push_back(cond->getOprType());
+    cond_type.push_back(cond->getType());
+    cond_lhs.push_back(lhs);
+    cond_rhs.push_back(rhs);
+    return cond_opr.size() - 1;
+}
+
+FlatAst::Index FlatAst::addBlock(ArenaList<Statement*> &codes,
+                                 LocalVarTable *vars)
+{
+    std::vector<Index> stmts;
+    for (auto code : codes) stmts.push_back(addStmt(code));
+
+    std::vector<Index> var_pairs;
+    for (auto &slot : vars->getSlots())
+    {
+        if (slot.sym == StringInterner::INVALID_SYMBOL) continue;
+        var_pairs.push_back(slot.sym);
+        var_pairs.push_back(static_cast<Index>(slot.type));
+    }
+
+    block_stmts.push_back(addList(stmts));
+    block_vars.push_back(addList(var_pairs));
+    return block_stmts.size() - 1;
+}
+
+FlatAst::Index FlatAst::addStmt(Statement *stmt)
+{
+    if (stmt->isStatementFunc())
+    {
+        auto func = static_cast<FuncStatement*>(stmt);
+
+        // (type, token) pairs
+        std::vector<Index> args;
+        for (auto &arg : func->getFuncArgs())
+        {
+            args.push_back(static_cast<Index>(arg.getArgType()));
+            args.push_back(addToken(arg.getToken()));
+        }
+        Index arg_list = addList(args);
+
+        Index block = addBlock(func->getFuncCodes(), func->getLocalVars());
+        return newStmt(StmtKind::FUNC_STATEMENT,
+                       addToken(func->getFuncToken()),
+                       block, arg_list, NONE,
+                       static_cast<Index>(func->getRetType()));
+    }
+    else if (stmt->isStatementAssn())
+    {
+        auto assn = static_cast<AssnStatement*>(stmt);
+        Index iden = addExpr(assn->getIden());
+        Index expr = addExpr(assn->getExpr());
+        return newStmt(StmtKind::ASSN_STATEMENT, NONE,
+                       iden, expr, NONE, NONE);
+    }
+    else if (stmt->isStatementRet())
+    {
+        auto ret = static_cast<RetStatement*>(stmt);
+        return newStmt(StmtKind::RET_STATEMENT, NONE,
+                       addExpr(ret->getRetVal()), NONE, NONE, NONE);
+    }
+    else if (stmt->isStatementBuiltinCall() || stmt->isStatementNormalCall())
+    {
+        auto call = static_cast<CallStatement*>(stmt);
+        Index expr = addExpr(call->getCallExpr());
+        return newStmt(stmt->isStatementBuiltinCall() ?
+                           StmtKind::BUILT_IN_CALL_STATEMENT :
+                           StmtKind::NORMAL_CALL_STATEMENT,
+                       NONE, expr, NONE, NONE, NONE);
+    }
+    else if (stmt->isStatementIf())
+    {
+        auto if_s = static_cast<IfStatement*>(stmt);
+        Index cond = addCond(if_s->getCond());
+        Index taken = addBlock(if_s->getTakenBlock(),
+                               if_s->getTakenBlockVars());
+        Index not_taken = addBlock(if_s->getNotTakenBlock(),
+                                   if_s->getNotTakenBlockVars());
+        return newStmt(StmtKind::IF_STATEMENT, NONE,
+                       cond, taken, not_taken, NONE);
+    }
+    else
+    {
+        assert(stmt->isStatementFor());
+        auto for_s = static_cast<ForStatement*>(stmt);
+        Index start = addStmt(for_s->getStart());
+        Index end = addCond(for_s->getEnd());
+        Index step = addStmt(for_s->getStep());
+        Index block = addBlock(for_s->getBlock(), for_s->getBlockVars());
+        return newStmt(StmtKind::FOR_STATEMENT, NONE,
+                       start, end, step, block);
+    }
+}
+
+/***************************** Back to nodes *****************************/
+void FlatAst::toProgram(Program &program)
+{
+    for (auto func : funcs)
+        program.addStatement(buildStmt(func, program));
+}
+
+Expression *FlatAst::buildExpr(Index e, Program &program)
+{
+    switch (exprKind(e))
+    {
+        case ExprKind::LITERAL:
+            return program.make<LiteralExpression>(toks[exprTok(e)]);
+
+        case ExprKind::ARRAY:
+        {
+            Expression *num_ele = buildExpr(exprLhs(e), program);
+            auto items = list(exprRhs(e));
+            auto eles = program.makeList<Expression*>(items.size());
+            for (Index i = 0; i < items.size(); i++)
+                eles[i] = buildExpr(items[i], program);
+            return program.make<ArrayExpression>(num_ele, eles);
+        }
+
+        case ExprKind::INDEX:
+        {
+            auto iden = program.make<Identifier>(toks[exprTok(e)]);
+            Expression *idx = buildExpr(exprLhs(e), program);
+            return program.make<IndexExpression>(iden, idx);
+        }
+
+        case ExprKind::CALL:
+        {
+            auto def = program.make<Identifier>(toks[exprTok(e)]);
+            auto items = list(exprRhs(e));
+            auto args = program.makeList<Expression*>(items.size());
+            for (Index i = 0; i < items.size(); i++)
+                args[i] = buildExpr(items[i], program);
+            return program.make<CallExpression>(def, args);
+        }
+
+        default:
+        {
+            // arithmetic
+            Expression *left = buildExpr(exprLhs(e), program);
+            Expression *right = buildExpr(exprRhs(e), program);
+            return program.make<ArithExpression>(left, right, exprKind(e));
+        }
+    }
+}
+
+Condition *FlatAst::buildCond(Index c, Program &program)
+{
+    Expression *left = buildExpr(condLhs(c), program);
+    Expression *right = buildExpr(condRhs(c), program);
+    return program.make<Condition>(left, right, condOpr(c), condType(c));
+}
+
+ArenaList<Statement*> FlatAst::buildBlock(Index b, Program &program,
+                                          LocalVarTable &local_vars)
+{
+    auto items = blockStmts(b);
+    auto stmts = program.makeList<Statement*>(items.size());
+    for (Index i = 0; i < items.size(); i++)
+        stmts[i] = buildStmt(items[i], program);
+
+    // (symbol, type) pairs
+    auto var_pairs = blockVars(b);
+    local_vars = LocalVarTable(program.getArena(), var_pairs.size() / 2,
+        [&var_pairs](size_t i)
+        {
+            return LocalVarTable::Slot{
+                var_pairs[2 * i],
+                static_cast<ValueType::Type>(var_pairs[2 * i + 1])};
+        });
+
+    return stmts;
+}
+
+Statement *FlatAst::buildStmt(Index s, Program &program)
+{
+    switch (stmtKind(s))
+    {
+        case StmtKind::FUNC_STATEMENT:
+        {
+            // (type, token) pairs
+            auto arg_list = list(stmtB(s));
+            auto args = program.makeList<FuncStatement::Argument>(
+                arg_list.size() / 2);
+            for (Index i = 0; i < args.size(); i++)
+            {
+                auto iden = program.make<Identifier>(
+                    toks[arg_list[2 * i + 1]]);
+                args[i] = FuncStatement::Argument(
+                    static_cast<ValueType::Type>(arg_list[2 * i]), iden);
+            }
+
+            LocalVarTable local_vars;
+            auto codes = buildBlock(stmtA(s), program, local_vars);
+            auto iden = program.make<Identifier>(toks[stmtTok(s)]);
+            return program.make<FuncStatement>(
+                static_cast<ValueType::Type>(stmtD(s)), iden,
+                args, codes, local_vars);
+        }
+
+        case StmtKind::ASSN_STATEMENT:
+        {
+            Expression *iden = buildExpr(stmtA(s), program);
+            Expression *expr = buildExpr(stmtB(s), program);
+            return program.make<AssnStatement>(iden, expr);
+        }
+
+        case StmtKind::RET_STATEMENT:
+            return program.make<RetStatement>(buildExpr(stmtA(s), program));
+
+        case StmtKind::BUILT_IN_CALL_STATEMENT:
+        case StmtKind::NORMAL_CALL_STATEMENT:
+            return program.make<CallStatement>(buildExpr(stmtA(s), program),
+                                               stmtKind(s));
+
+        case StmtKind::IF_STATEMENT:
+        {
+            Condition *cond = buildCond(stmtA(s), program);
+            LocalVarTable taken_vars, not_taken_vars;
+            auto taken = buildBlock(stmtB(s), program, taken_vars);
+            auto not_taken = buildBlock(stmtC(s), program,
+                                        not_taken_vars);
+            return program.make<IfStatement>(cond, taken, not_taken,
+                                             taken_vars, not_taken_vars);
+        }
+
+        default:
+        {
+            assert(stmtKind(s) == StmtKind::FOR_STATEMENT);
+            Statement *start = buildStmt(stmtA(s), program);
+            Condition *end = buildCond(stmtB(s), program);
+            Statement *step = buildStmt(stmtC(s), program);
+            LocalVarTable block_vars;
+            auto block = buildBlock(stmtD(s), program, block_vars);
+            return program.make<ForStatement>(start, end, step, block,
+                                              block_vars);
+        }
+    }
+}
+
+/******************************** Printing *******************************/
+// Mirrors the print()/printStatement() members of the pointer AST
+std::string FlatAst::printExpr(Index e, unsigned level)
+{
+    std::string prefix(level * 2, ' ');
+    std::string ret = "";
+
+    switch (exprKind(e))
+    {
+        case ExprKind::LITERAL:
+            return std::string(toks[exprTok(e)].getLiteral()) + "\n";
+
+        case ExprKind::ARRAY:
+        {
+            Index num_ele = exprLhs(e);
+            ret = prefix + "{\n";
+            ret += (prefix + "  [ARRAY] \n");
+            ret += (prefix + "  [NUM ELEMENTS]\n");
+            ret += (prefix + "  {\n");
+            if (exprKind(num_ele) == ExprKind::LITERAL)
+                ret += (prefix + "    ");
+            ret += printExpr(num_ele, level + 2);
+            ret += (prefix + "  }\n");
+
+            ret += (prefix + "  [ELEMENTS]\n");
+            ret += (prefix + "  {\n");
+            for (auto ele : list(exprRhs(e)))
+            {
+                ret += (prefix + "    {\n");
+                if (exprKind(ele) == ExprKind::LITERAL)
+                    ret += (prefix + "      ");
+                ret += printExpr(ele, level + 3);
+                ret += (prefix + "    }\n");
+            }
+            ret += (prefix + "  }\n");
+            ret += (prefix + "}\n");
+            return ret;
+        }
+
+        case ExprKind::INDEX:
+        {
+            Index idx = exprLhs(e);
+            ret = prefix + "{\n";
+            ret += (prefix + "  [ARRAY] " +
+                    std::string(toks[exprTok(e)].getLiteral()) + "\n");
+            ret += (prefix + "  [INDEX]\n");
+            ret += (prefix + "  {\n");
+            if (exprKind(idx) == ExprKind::LITERAL)
+                ret += (prefix + "      ");
+            ret += printExpr(idx, level + 3);
+            ret += (prefix + "  }\n");
+            ret += (prefix + "}\n");
+            return ret;
+        }
+
+        case ExprKind::CALL:
+        {
+            ret = prefix + "{\n";
+            ret += (prefix + "  [CALL] " +
+                    std::string(toks[exprTok(e)].getLiteral()) + "\n");
+            unsigned idx = 0;
+            for (auto arg : list(exprRhs(e)))
+            {
+                ret += (prefix + "  [ARG " + std::to_string(idx++) + "]\n");
+                ret += (prefix + "  {\n");
+                if (exprKind(arg) == ExprKind::LITERAL)
+                    ret += (prefix + "    ");
+                ret += printExpr(arg, level + 2);
+                ret += (prefix + "  }\n");
+            }
+            ret += (prefix + "}\n");
+            return ret;
+        }
+
+        default:
+            break;
+    }
+
+    // arithmetic
+    auto printOperand = [&](Index operand)
+    {
+        if (exprKind(operand) == ExprKind::CALL)
+            ret += printExpr(operand, level);
+        else
+            ret += printExpr(operand, level + 1);
+    };
+
+    Index left = exprLhs(e);
+    if (exprKind(left) == ExprKind::LITERAL) ret += prefix;
+    printOperand(left);
+
+    Index right = exprRhs(e);
+    ret += prefix;
+    switch (exprKind(e))
+    {
+        case ExprKind::PLUS: ret += "+"; break;
+        case ExprKind::MINUS: ret += "-"; break;
+        case ExprKind::ASTERISK: ret += "*"; break;
+        case ExprKind::SLASH: ret += "/"; break;
+        default: break;
+    }
+    ret += "\n";
+    if (exprKind(right) == ExprKind::LITERAL) ret += prefix;
+    printOperand(right);
+
+    return ret;
+}
+
+void FlatAst::printCond(Index c)
+{
+    static constexpr const char *oprs[] = {"==", "!=", ">", ">=", "<", "<="};
+
+    std::cout << "  {\n";
+    std::cout << "    [Left]\n";
+    if (exprKind(condLhs(c)) == ExprKind::LITERAL)
+        std::cout << "      " << printExpr(condLhs(c), 3) << "\n";
+    else
+        std::cout << printExpr(condLhs(c), 3) << "\n";
+    std::cout << "    [COMP] " << oprs[static_cast<int>(condOpr(c))]
+              << "\n\n";
+    std::cout << "    [Right]\n";
+    if (exprKind(condRhs(c)) == ExprKind::LITERAL)
+        std::cout << "      " << printExpr(condRhs(c), 3) << "\n";
+    else
+        std::cout << printExpr(condRhs(c), 3) << "\n";
+    std::cout << "  }\n";
+}
+
+void FlatAst::printBlock(Index b)
+{
+    for (auto stmt : blockStmts(b)) printStmt(stmt);
+}
+
+void FlatAst::printStmt(Index s)
+{
+    // "      " + expression, or the expression's own indentation
+    auto printIndented = [this](Index e)
+    {
+        if (exprKind(e) == ExprKind::LITERAL)
+            std::cout << "      " << printExpr(e, 4);
+        else
+            std::cout << printExpr(e, 4);
+    };
+
+    switch (stmtKind(s))
+    {
+        case StmtKind::FUNC_STATEMENT:
+        {
+            std::cout << "{\n";
+            std::cout << "  Function Name: "
+                      << toks[stmtTok(s)].getLiteral() << "\n";
+            std::cout << "  Return Type: ";
+            auto ret_type = static_cast<ValueType::Type>(stmtD(s));
+            if (ret_type == ValueType::Type::VOID)
+                std::cout << "void\n";
+            else if (ret_type == ValueType::Type::INT)
+                std::cout << "int\n";
+            else if (ret_type == ValueType::Type::FLOAT)
+                std::cout << "float\n";
+
+            std::cout << "  Arguments\n";
+            auto args = list(stmtB(s));
+            for (Index i = 0; i < args.size(); i += 2)
+            {
+                auto type = static_cast<ValueType::Type>(args[i]);
+                std::cout << "    ";
+                if (type == ValueType::Type::INT) std::cout << "int : ";
+                else if (type == ValueType::Type::FLOAT)
+                    std::cout << "float : ";
+                std::cout << toks[args[i + 1]].getLiteral() << "\n";
+            }
+            if (!args.size()) std::cout << "    NONE\n";
+
+            std::cout << "  Codes\n";
+            std::cout << "  {\n";
+            printBlock(stmtA(s));
+            std::cout << "  }\n";
+            std::cout << "}\n";
+            return;
+        }
+
+        case StmtKind::ASSN_STATEMENT:
+            std::cout << "    {\n";
+            printIndented(stmtA(s));
+            std::cout << "      =\n";
+            printIndented(stmtB(s));
+            std::cout << "    }\n";
+            return;
+
+        case StmtKind::RET_STATEMENT:
+            std::cout << "    {\n";
+            std::cout << "      [Return]\n";
+            printIndented(stmtA(s));
+            std::cout << "    }\n";
+            return;
+
+        case StmtKind::BUILT_IN_CALL_STATEMENT:
+        case StmtKind::NORMAL_CALL_STATEMENT:
+            std::cout << printExpr(stmtA(s), 2);
+            return;
+
+        case StmtKind::IF_STATEMENT:
+            std::cout << "  {\n";
+            std::cout << "  [IF Statement] \n";
+            std::cout << "  [Condition]\n";
+            printCond(stmtA(s));
+            std::cout << "  [Taken Block]\n";
+            std::cout << "  {\n";
+            printBlock(stmtB(s));
+            std::cout << "  }\n";
+            if (blockStmts(stmtC(s)).size() == 0)
+            {
+                std::cout << "  }\n";
+                return;
+            }
+            std::cout << "  [Not Taken Block]\n";
+            std::cout << "  {\n";
+            printBlock(stmtC(s));
+            std::cout << "  }\n";
+            std::cout << "  }\n";
+            return;
+
+        case StmtKind::FOR_STATEMENT:
+            std::cout << "  {\n";
+            std::cout << "  [For Statement] \n";
+            std::cout << "  [Start]\n";
+            printStmt(stmtA(s));
+            std::cout << "  [End]\n";
+            printCond(stmtB(s));
+            std::cout << "  [Step]\n";
+            printStmt(stmtC(s));
+            std::cout << "  [Block]\n";
+            std::cout << "  {\n";
+            printBlock(stmtD(s));
+            std::cout << "  }\n";
+            std::cout << "  }\n";
+            return;
+
+        default:
+            return;
+    }
+}
+
+void FlatAst::printStatements()
+{
+    for (auto func : funcs) printStmt(func);
+}
+}
@@ -0,0 +1,228 @@
+#ifndef __FLAT_AST_HH__
+#define __FLAT_AST_HH__
+
+#include "parser/parser.hh"
+
+#include <cstdint>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * FlatAst - index-based (struct-of-arrays) form of a Program.
+ *
+ * Every expression, condition and statement is a row in a few parallel
+ * arrays (kind, token, operands) and refers to other nodes by 32-bit
+ * index instead of by pointer. There are no virtual calls: a consumer
+ * switches on the kind. Variable-length data (call arguments, array
+ * elements, statement lists, function arguments, block variables) goes
+ * into one extra array as [count, item, item, ...], and the node keeps
+ * the offset of the count.
+ *
+ * Operands by kind:
+ *
+ *   Expressions               tok          lhs          rhs
+ *     LITERAL                 the literal  -            -
+ *     PLUS/MINUS/ASTERISK/... -            left expr    right expr
+ *     ARRAY                   -            num elements list of exprs
+ *     INDEX                   array name   index expr   -
+ *     CALL                    callee       -            list of exprs
+ *
+ *   Statements                tok          a            b       c     d
+ *     FUNC                    name         block        args    -     ret
+ *     ASSN                    -            target expr  value   -     -
+ *     RET                     -            expr         -       -     -
+ *     *_CALL                  -            call expr    -       -     -
+ *     IF                      -            cond         taken   else  -
+ *     FOR                     -            start stmt   cond    step  block
+ *
+ * A block is a statement list plus the variables it declares, a list of
+ * (symbol, type) pairs. Function arguments are (type, token) pairs.
+ *
+ * The Program stays the primary AST for now; FlatAst is built from it so
+ * that passes can move over one at a time. It is also the form the AST
+ * is cached in (see ast_cache.hh), toProgram() turns it back into nodes.
+ * */
+class FlatAst
+{
+  public:
+    using Index = uint32_t;
+    static constexpr Index NONE = UINT32_MAX;
+
+    using ExprKind = Expression::ExpressionType;
+    using StmtKind = Statement::StatementType;
+    using OprKind = Condition::OperatorType;
+
+    // A view of one [count, items...] list in extra
+    struct List
+    {
+        const Index *items;
+        Index count;
+
+        const Index *begin() const { return items; }
+        const Index *end() const { return items + count; }
+        Index size() const { return count; }
+        Index operator[](Index i) const { return items[i]; }
+    };
+
+    // One array of the AST: grown while converting a Program, or
+    // borrowed from memory someone else owns (a mapped AstCache file)
+    template<typename T>
+    class Array
+    {
+      protected:
+        std::vector<T> owned;
+        const T *items = nullptr;
+        size_t count = 0;
+
+      public:
+        using value_type = T;
+
+        void push_back(const T &item)
+        {
+            owned.push_back(item);
+            items = owned.data();
+            count = owned.size();
+        }
+
+        void reserve(size_t n) { owned.reserve(n); }
+
+        void borrow(const T *_items, size_t _count)
+        {
+            owned.clear();
+            items = _items;
+            count = _count;
+        }
+
+        const T &operator[](size_t i) const { return items[i]; }
+        const T *data() const { return items; }
+        size_t size() const { return count; }
+
+        const T *begin() const { return items; }
+        const T *end() const { return items + count; }
+    };
+
+  protected:
+    std::vector<Token> toks;
+
+    // Expressions
+    Array<ExprKind> expr_kind;
+    Array<Index> expr_tok;
+    Array<Index> expr_lhs;
+    Array<Index> expr_rhs;
+
+    // Conditions
+    Array<OprKind> cond_opr;
+    Array<ValueType::Type> cond_type;
+    Array<Index> cond_lhs;
+    Array<Index> cond_rhs;
+
+    // Statements
+    Array<StmtKind> stmt_kind;
+    Array<Index> stmt_tok;
+    Array<Index> stmt_a;
+    Array<Index> stmt_b;
+    Array<Index> stmt_c;
+    Array<Index> stmt_d;
+
+    // Blocks
+    Array<Index> block_stmts;
+    Array<Index> block_vars;
+
+    Array<Index> extra;
+
+    // FUNC statements in program order
+    Array<Index> funcs;
+
+    friend class AstCache;
+
+  public:
+    // Number of arrays visited by forEachArray()
+    static constexpr unsigned NUM_ARRAYS = 18;
+
+    // Empty AST, to be filled by AstCache. It borrows the arrays of the
+    // cache, which must outlive it.
+    FlatAst() {}
+    explicit FlatAst(Program &program);
+
+    // Calls f on every array except the tokens, always in this order
+    template<typename F>
+    void forEachArray(F &&f)
+    {
+        f(expr_kind); f(expr_tok); f(expr_lhs); f(expr_rhs);
+        f(cond_opr); f(cond_type); f(cond_lhs); f(cond_rhs);
+        f(stmt_kind); f(stmt_tok);
+        f(stmt_a); f(stmt_b); f(stmt_c); f(stmt_d);
+        f(block_stmts); f(block_vars);
+        f(extra);
+        f(funcs);
+    }
+
+    // Builds the nodes of every function in program (in its arena) and
+    // adds them as its statements
+    void toProgram(Program &program);
+
+    size_t numExprs() const { return expr_kind.size(); }
+    size_t numStmts() const { return stmt_kind.size(); }
+    // Bytes held by all the arrays
+    size_t bytesUsed() const;
+
+    auto &getFuncs() const { return funcs; }
+    Token &getToken(Index tok) { return toks[tok]; }
+
+    ExprKind exprKind(Index e) const { return expr_kind[e]; }
+    Index exprTok(Index e) const { return expr_tok[e]; }
+    Index exprLhs(Index e) const { return expr_lhs[e]; }
+    Index exprRhs(Index e) const { return expr_rhs[e]; }
+
+    OprKind condOpr(Index c) const { return cond_opr[c]; }
+    ValueType::Type condType(Index c) const { return cond_type[c]; }
+    Index condLhs(Index c) const { return cond_lhs[c]; }
+    Index condRhs(Index c) const { return cond_rhs[c]; }
+
+    StmtKind stmtKind(Index s) const { return stmt_kind[s]; }
+    Index stmtTok(Index s) const { return stmt_tok[s]; }
+    Index stmtA(Index s) const { return stmt_a[s]; }
+    Index stmtB(Index s) const { return stmt_b[s]; }
+    Index stmtC(Index s) const { return stmt_c[s]; }
+    Index stmtD(Index s) const { return stmt_d[s]; }
+
+    List blockStmts(Index b) const { return list(block_stmts[b]); }
+    // (symbol, type) pairs, count is twice the number of variables
+    List blockVars(Index b) const { return list(block_vars[b]); }
+
+    List list(Index offset) const
+    {
+        return List{extra.data() + offset + 1, extra[offset]};
+    }
+
+    // Same output as Program::printStatements()
+    void printStatements();
+
+  protected:
+    Index addToken(Token &tok);
+    Index addList(const std::vector<Index> &items);
+
+    Index addExpr(Expression *expr);
+    Index addCond(Condition *cond);
+    Index addStmt(Statement *stmt);
+    Index addBlock(ArenaList<Statement*> &codes, LocalVarTable *vars);
+
+    Index newExpr(ExprKind kind, Index tok, Index lhs, Index rhs);
+    Index newStmt(StmtKind kind, Index tok,
+                  Index a, Index b, Index c, Index d);
+
+    Expression *buildExpr(Index e, Program &program);
+    Condition *buildCond(Index c, Program &program);
+    Statement *buildStmt(Index s, Program &program);
+    ArenaList<Statement*> buildBlock(Index b, Program &program,
+                                     LocalVarTable &local_vars);
+
+    std::string printExpr(Index e, unsigned level);
+    void printCond(Index c);
+    void printStmt(Index s);
+    void printBlock(Index b);
+};
+}
+
+#endif
@@ -1,14 +1,163 @@
 #include "lexer/lexer.hh"
+#include "parser/ast_cache.hh"
+#include "parser/flat_ast.hh"
 #include "parser/parser.hh"
 
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
 
 using namespace Frontend;
 
+// Parses fn twice through an empty AST cache: the second parser has to
+// load the AST the first one wrote, and both must print the same tree.
+static int checkAstCache(const char *fn, const LexOptions &lex_opts,
+                         ParseOptions parse_opts)
+{
+    if (strcmp(fn, "-") == 0)
+    {
+        std::cerr << "[Error] --check-ast-cache needs a file\n";
+        exit(1);
+    }
+
+    char dir[] = "/tmp/ast_cache_XXXXXX";
+    if (mkdtemp(dir) == nullptr)
+    {
+        std::cerr << "[Error] --check-ast-cache: cannot create "
+                  << dir << "\n";
+        exit(1);
+    }
+    parse_opts.ast_cache_dir = dir;
+
+    auto printed = [](Parser &parser)
+    {
+        std::ostringstream out;
+        auto old = std::cout.rdbuf(out.rdbuf());
+        parser.printStatements();
+        std::cout.rdbuf(old);
+        return out.str();
+    };
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    Parser parsed(fn, lex_opts, parse_opts);
+    std::chrono::duration<double, std::milli> parse_ms =
+        Clock::now() - start;
+
+    start = Clock::now();
+    Parser loaded(fn, lex_opts, parse_opts);
+    std::chrono::duration<double, std::milli> load_ms =
+        Clock::now() - start;
+
+    bool ok = AstCache::stats.hits == 1 &&
+              printed(parsed) == printed(loaded);
+    std::filesystem::remove_all(dir);
+
+    if (AstCache::stats.hits != 1)
+        std::cerr << "[Error] the AST cache was not written or not loaded\n";
+    else if (!ok)
+        std::cerr << "[Error] the loaded AST differs from the parsed one\n";
+    else
+        std::cerr << "[AstCache] round trip OK, parse + store: "
+                  << parse_ms.count() << " ms, load: "
+                  << load_ms.count() << " ms\n";
+
+    return ok ? 0 : 1;
+}
+
+// Usage: ./parser <source> [--threads N] [--token-cache DIR]
+//                          [--parse-threads N] [--ast-cache DIR]
+//                          [--edit OFFSET LENGTH TEXT]...
+//   <source>: a file, or "-" to stream stdin (pipes are streamed too)
+//   --threads: lex the file on N threads before parsing
+//   --token-cache: reuse/write the binary token stream in DIR
+//   --parse-threads: parse the function bodies on N threads (the
+//                    signatures are always recorded first, so a call
+//                    may come before the callee's definition)
+//   --edit: after parsing, replace LENGTH bytes at OFFSET with TEXT and
+//           reparse incrementally (repeatable, applied in order)
+//   --ast-cache: reuse/write the binary AST in DIR, an unchanged source
+//                is then neither lexed nor parsed
+//   --flat: convert the AST to the flat (index-based) form and print
+//           that instead, with the conversion stats on stderr
+//   --check-ast-cache: parse, store the AST in a temporary cache, load
+//                      it back and compare the printed trees (exits 1 if
+//                      they differ)
 int main(int argc, char* argv[])
 {
+    bool flat = false;
+    bool check_ast_cache = false;
+    LexOptions lex_opts;
+    ParseOptions parse_opts;
+    std::vector<std::tuple<size_t, size_t, std::string>> edits;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--flat") == 0)
+            flat = true;
+        else if (strcmp(argv[i], "--check-ast-cache") == 0)
+            check_ast_cache = true;
+        else if (i + 1 == argc)
+            break;
+        else if (strcmp(argv[i], "--threads") == 0)
+            lex_opts.threads = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--token-cache") == 0)
+            lex_opts.token_cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--parse-threads") == 0)
+            parse_opts.threads = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--ast-cache") == 0)
+            parse_opts.ast_cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--edit") == 0 && i + 3 < argc)
+        {
+            edits.emplace_back(std::stoul(argv[i + 1]),
+                               std::stoul(argv[i + 2]),
+                               argv[i + 3]);
+            i += 3;
+        }
+    }
+
+    if (check_ast_cache) return checkAstCache(argv[1], lex_opts, parse_opts);
+
     // Parser
-    Parser parser(argv[1]);
-    parser.printStatements();
+    Parser parser(argv[1], lex_opts, parse_opts);
+
+    for (auto &[offset, length, text] : edits)
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t num_funcs = parser.applyEdit(offset, length, text);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cerr << "[Edit] @" << offset << ": reparsed " << num_funcs
+                  << " function(s) in " << elapsed.count() << " ms\n";
+    }
+
+    if (flat)
+    {
+        auto start = std::chrono::steady_clock::now();
+        FlatAst ast(parser.getProgram());
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cerr << "[FlatAst] " << ast.numStmts() << " statements, "
+                  << ast.numExprs() << " expressions, "
+                  << ast.bytesUsed() << " bytes (arena: "
+                  << parser.getProgram().getArena().bytesUsed()
+                  << " bytes), converted in " << elapsed.count()
+                  << " ms\n";
+
+        ast.printStatements();
+    }
+    else
+    {
+        parser.printStatements();
+    }
+
+    if (lex_opts.token_cache_dir != nullptr) TokenCache::reportStats();
+    if (parse_opts.ast_cache_dir != nullptr) AstCache::reportStats();
 }
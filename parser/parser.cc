@@ -1,13 +1,51 @@
 #include "parser/parser.hh"
+#include "parser/ast_cache.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 
 namespace Frontend
 {
-Parser::Parser(const char* fn) : lexer(new Lexer(fn))
+Parser::Parser(const char* fn, const LexOptions &lex_opts,
+               const ParseOptions &parse_opts)
+    : lexer(new Lexer(fn))
+    , parse_threads(parse_opts.on_function ? 1 : parse_opts.threads)
+    , on_function(parse_opts.on_function)
 {
+    strings = &lexer->getStrings();
+    diags.setFileName(strcmp(fn, "-") == 0 ? "<stdin>" : fn);
+
+    // A cached AST of this exact source skips lexing and parsing
+    std::string cache_fn;
+    uint64_t content_hash = 0;
+    if (parse_opts.ast_cache_dir != nullptr && !on_function)
+    {
+        lexer->fillSource();
+        content_hash = TokenCache::hashContent(lexer->getSource());
+        cache_fn = AstCache::path(parse_opts.ast_cache_dir, content_hash);
+        if (loadAst(cache_fn, content_hash)) return;
+    }
+
+    lexer->setup(lex_opts);
+
     // Pre-load all the tokens
-    lexer->getToken(cur_token);
-    lexer->getToken(next_token);
+    tokens = std::make_unique<TokenStream>(lexer.get());
+    cur_token = tokens->peek();
+
+    recordBuiltins();
+
+    parseProgram();
+    reportErrors();
+
+    if (!cache_fn.empty()) storeAst(cache_fn, content_hash);
+}
+
+Parser::~Parser() {}
 
+void Parser::recordBuiltins()
+{
     // Fill the pre-built 
     std::vector<ValueType::Type> arg_types;
     ValueType::Type ret_type = ValueType::Type::VOID;
@@ -18,7 +56,10 @@ Parser::Parser(const char* fn) : lexer(new Lexer(fn))
     record.ret_type = ret_type;
     record.arg_types = arg_types;
     record.is_built_in = true;
-    func_def_tracker.insert({"printVarInt", record});
+    record.is_defined = true;
+    Symbol sym = strings->intern("printVarInt");
+    if (sym >= func_def_tracker.size()) func_def_tracker.resize(sym + 1);
+    func_def_tracker[sym] = record;
 
     // printVarFloat
     arg_types.clear();
@@ -26,192 +67,347 @@ Parser::Parser(const char* fn) : lexer(new Lexer(fn))
     record.ret_type = ret_type;
     record.arg_types = arg_types;
     record.is_built_in = true;
-    func_def_tracker.insert({"printVarFloat", record});
-
-    parseProgram();
+    record.is_defined = true;
+    sym = strings->intern("printVarFloat");
+    if (sym >= func_def_tracker.size()) func_def_tracker.resize(sym + 1);
+    func_def_tracker[sym] = record;
 }
 
 void Parser::advanceTokens()
 {
-    cur_token = next_token;
-    lexer->getToken(next_token);
+    if (cur_token.isTokenLBrace())
+        brace_depth++;
+    else if (cur_token.isTokenRBrace() && brace_depth > 0)
+        brace_depth--;
+
+    tokens->advance();
+    cur_token = tokens->peek();
 }
 
-void Parser::parseProgram()
+/************************ Errors and recovery ****************************/
+void Parser::error(const Token &_tok, std::string msg)
 {
-    // Should always be functions to start with since
-    // we don't support globals or structures...
-    while (!cur_token.isTokenEOF())
+    // Tokens made up by the parser have no location, blame the current
+    // token instead
+    Lexer *lex = (owner != nullptr) ? owner->lexer.get() : lexer.get();
+    SourceLocation loc = lex->getLocation(_tok);
+    std::string_view line = lex->getLine(_tok);
+    if (loc.line == 0)
     {
-        ValueType::Type ret_type;
-        std::unique_ptr<Identifier> iden;
-        std::vector<FuncStatement::Argument> args;
-        std::vector<std::shared_ptr<Statement>> codes;
+        loc = lex->getLocation(cur_token);
+        line = lex->getLine(cur_token);
+    }
+    if (loc.line != 0) loc.line += line_offset;
+
+    diags.error(loc, line, std::move(msg));
+}
 
-        // determine return type
-        ret_type = ValueType::typeTokenToValueType(cur_token);
-        if (ret_type == ValueType::Type::MAX)
+void Parser::syntaxError(const Token &_tok, std::string msg)
+{
+    // Whatever goes wrong while skipping is a consequence of the first
+    // error
+    if (panic) return;
+
+    error(_tok, std::move(msg));
+    panic = true;
+}
+
+// Skips the rest of a statement that failed to parse, in a block whose
+// statements are at brace depth depth. Stops at the statement's ';', at
+// the '}' closing its own block (unless an else follows), or at the '}'
+// closing the enclosing block. Stays in panic mode if it runs into the
+// next function or the end of the file instead.
+void Parser::syncStatement(unsigned depth)
+{
+    while (!cur_token.isTokenEOF() && !isFuncStart())
+    {
+        if (brace_depth <= depth)
+        {
+            if (cur_token.isTokenSemicolon() || cur_token.isTokenRBrace())
+            {
+                panic = false;
+                return;
+            }
+        }
+        else if (brace_depth == depth + 1 &&
+                 cur_token.isTokenRBrace() &&
+                 !peekToken(1).isTokenElse())
         {
-	    std::cerr << "[Error] parseProgram: unsupported return type\n"
-                      << "[Line] " << cur_token.getLine() << "\n";
-	    exit(0);
+            panic = false;
+            return;
         }
-                
-        // function name
+
         advanceTokens();
-        iden = std::make_unique<Identifier>(cur_token);
-        if (!next_token.isTokenLP())
-        {
-            std::cerr << "[Error] Incorrect function defition.\n "
-                      << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
-	}
+    }
+}
 
+// Skips to the start of the next function after a function failed to
+// parse (func_start is its first token).
+void Parser::syncFunction(const char *func_start)
+{
+    while (!cur_token.isTokenEOF() &&
+           (!isFuncStart() || cur_token.text == func_start))
         advanceTokens();
-        assert(cur_token.isTokenLP());
 
-        // Track local variables
-	std::unordered_map<std::string,ValueType::Type> local_vars;
-        local_vars_tracker.push_back(&local_vars);
+    // Functions do not nest, whatever is still open was never closed
+    brace_depth = 0;
+    panic = false;
+}
+
+void Parser::reportErrors()
+{
+    if (!diags.hasErrors()) return;
+
+    diags.report(std::cerr);
+    exit(1);
+}
 
-        // extract arguments
-        while (!cur_token.isTokenRP())
+/****************************** Parsing **********************************/
+void Parser::parseProgram()
+{
+    for (auto func : parseFunctionsParallel()) program.addStatement(func);
+}
+
+std::vector<Statement*> Parser::parseFunctions()
+{
+    std::vector<Statement*> funcs;
+    func_starts.clear();
+
+    // Should always be functions to start with since
+    // we don't support globals or structures...
+    while (!cur_token.isTokenEOF())
+    {
+        func_starts.push_back(cur_token.text);
+        if (auto func = parseFunction(); func != nullptr)
         {
+            if (!on_function)
+                funcs.push_back(func);
+            else if (!diags.hasErrors())
+                on_function(this, func);
             advanceTokens();
-            if (cur_token.isTokenRP()) break; // no args
+        }
+        else
+        {
+            syncFunction(func_starts.back());
+            func_starts.pop_back();
+        }
 
-            std::string arg_type = cur_token.getLiteral();
+        // Only the signature outlives a pipelined function
+        if (on_function) program.getArena().reset();
+    }
 
-            advanceTokens();
-            std::unique_ptr<Identifier> iden(new Identifier(cur_token));
-            FuncStatement::Argument arg(arg_type, iden);
-            args.push_back(arg);
+    return funcs;
+}
+
+// Parses one function, cur_token is its closing brace on return
+Statement *Parser::parseFunction()
+{
+    ValueType::Type ret_type;
+    Identifier *iden;
+    std::vector<FuncStatement::Argument> args;
+    std::vector<Statement*> codes;
+
+    // determine return type
+    ret_type = ValueType::typeTokenToValueType(cur_token);
+    if (ret_type == ValueType::Type::MAX)
+    {
+        syntaxError(cur_token, "expected a function definition, got " +
+                               describe(cur_token));
+        return nullptr;
+    }
+            
+    // function name
+    advanceTokens();
+    if (!expect(Token::TokenType::TOKEN_IDENTIFIER, "a function name"))
+        return nullptr;
+    iden = program.make<Identifier>(cur_token);
+
+    advanceTokens();
+    if (!expect(Token::TokenType::TOKEN_LPAREN, "'('"))
+        return nullptr;
 
-            recordLocalVars(arg);
+    // Track local variables
+    var_scopes.enterScope();
 
+    // extract arguments
+    advanceTokens();
+    while (!cur_token.isTokenRP())
+    {
+        if (!args.empty())
+        {
+            if (!expect(Token::TokenType::TOKEN_COMMA, "',' or ')'"))
+                break;
             advanceTokens();
         }
-        assert(cur_token.isTokenRP());
+
+        std::string_view arg_type = cur_token.getLiteral();
+        if (ValueType::strToValueType(arg_type) == ValueType::Type::MAX)
+        {
+            syntaxError(cur_token, "expected an argument type, got " +
+                                   describe(cur_token));
+            break;
+        }
 
         advanceTokens();
-        assert(cur_token.isTokenLBrace());
+        if (!expect(Token::TokenType::TOKEN_IDENTIFIER, "an argument name"))
+            break;
+        FuncStatement::Argument arg(arg_type,
+                                    program.make<Identifier>(cur_token));
+        args.push_back(arg);
 
-        // record function def
-        recordDefs(iden->getLiteral(), ret_type, args);
+        recordLocalVars(arg);
 
-        // parse the codes section
-        while (true)
-        {
-            advanceTokens();
-            if (cur_token.isTokenRBrace())
-                    break;
+        advanceTokens();
+    }
 
-            parseStatement(iden->getLiteral(), codes);
+    if (!panic)
+    {
+        advanceTokens();
+        expect(Token::TokenType::TOKEN_LBRACE, "'{'");
+    }
 
-            // We just finished an if/for statement
-            if (codes.back()->isStatementIf() ||
-                codes.back()->isStatementFor())
-            {
-                // This RBrace is from the statement,
-                // should not terminate.
-                assert(cur_token.isTokenRBrace());
-            }
+    if (!panic)
+    {
+        // record function def, the first definition wins. Workers got
+        // every signature from splitFunctions() already.
+        if (owner == nullptr)
+        {
+            if (findFuncDef(iden->getSymbol()) != nullptr)
+                error(iden->getToken(),
+                      "redefinition of function '" +
+                      std::string(iden->getLiteral()) + "'");
             else
-            {
-                if (cur_token.isTokenRBrace())
-                    break;
-            }
+                recordDefs(iden->getSymbol(), ret_type, args);
         }
-        /*
-        while (!cur_token.isTokenRBrace() || 
-                rb_degree != entering_sub_block)
+
+        // parse the codes section
+        parseBlock(iden->getSymbol(), codes);
+    }
+
+    LocalVarTable local_vars;
+    if (!panic) local_vars = program.makeVarTable(var_scopes);
+    var_scopes.exitScope();
+
+    if (panic) return nullptr;
+
+    return program.make<FuncStatement>(ret_type, 
+                                       iden, 
+                                       program.makeList(args), 
+                                       program.makeList(codes),
+                                       local_vars);
+}
+
+// Parses the statements of a block, cur_token is its opening brace on
+// entry and its closing brace on return. A statement that fails to parse
+// is skipped; only a block that never ends returns in panic mode.
+void Parser::parseBlock(Symbol cur_func_name,
+                        std::vector<Statement*> &codes)
+{
+    // Brace depth of the statements in this block
+    unsigned depth = brace_depth + 1;
+
+    advanceTokens();
+    while (true)
+    {
+        if (cur_token.isTokenRBrace())
+            return;
+
+        // Functions do not nest, a function here means a missing brace
+        if (cur_token.isTokenEOF() || isFuncStart())
         {
-            advanceTokens();
-            parseStatement(iden->getLiteral(), codes);
+            syntaxError(cur_token, "expected '}', got " +
+                                   describe(cur_token));
+            return;
+        }
 
-            if (cur_token.isTokenRBrace())
-                entering_sub_block--;
+        parseStatement(cur_func_name, codes);
+        if (panic)
+        {
+            syncStatement(depth);
+            if (panic) return;
         }
-        */
-        std::unique_ptr<Statement> func_proto
-            (new FuncStatement(ret_type, 
-                               iden, 
-                               args, 
-                               codes,
-                               local_vars));
-        local_vars_tracker.pop_back();
-
-        program.addStatement(func_proto);
-        
+
+        // A statement ends at its ';' or at the '}' of its own block (if,
+        // for). After an error, this may be the '}' of this block.
+        if (cur_token.isTokenRBrace() && brace_depth == depth)
+            return;
+
         advanceTokens();
     }
 }
 
-void Parser::parseStatement(std::string &cur_func_name, 
-                            std::vector<std::shared_ptr<Statement>> &codes)
+void Parser::parseStatement(Symbol cur_func_name, 
+                            std::vector<Statement*> &codes)
 {
+    Statement *code = nullptr;
+
     // is it an if statement?
     if (cur_token.isTokenIf())
     {
-        auto code = parseIfStatement(cur_func_name);
-        codes.push_back(std::move(code));
+        code = parseIfStatement(cur_func_name);
+        if (code != nullptr) codes.push_back(code);
         return;
     }
 
     if (cur_token.isTokenFor())
     {
-        auto code = parseForStatement(cur_func_name);
-        codes.push_back(std::move(code));
+        code = parseForStatement(cur_func_name);
+        if (code != nullptr) codes.push_back(code);
         return;
     }
 
     // is it a function call?
     if (auto [is_def, is_built_in] = 
-            isFuncDef(cur_token.getLiteral());
+            isFuncDef(cur_token);
         is_def)
     {
         Statement::StatementType call_type = is_built_in ?
             Statement::StatementType::BUILT_IN_CALL_STATEMENT :
             Statement::StatementType::NORMAL_CALL_STATEMENT;
 
-        auto code = parseCall();
-        std::unique_ptr<CallStatement> call = 
-            std::make_unique<CallStatement>(code, call_type); 
-
-        codes.push_back(std::move(call));
+        auto call = parseCall();
+        if (call == nullptr) return;
+        advanceTokens();
 
-        return;
+        code = program.make<CallStatement>(call, call_type);
     }
-
     // it it a return statement?
-    if (cur_token.isTokenReturn())
+    else if (cur_token.isTokenReturn())
     {
 	advanceTokens();
 
         cur_expr_type = getFuncRetType(cur_func_name);
         auto ret = parseExpression();
+        if (ret == nullptr) return;
 
-        std::unique_ptr<RetStatement> ret_statement = 
-            std::make_unique<RetStatement>(ret);
-
-        codes.push_back(std::move(ret_statement));
-
-        return;
+        code = program.make<RetStatement>(ret);
     }
-
     // is it a variable-assignment?
-    if (isTokenTypeKeyword(cur_token) ||
-        cur_token.isTokenIden())
+    else if (isTokenTypeKeyword(cur_token) ||
+             cur_token.isTokenIden())
     {
-        auto code = parseAssnStatement();
-
-        codes.push_back(std::move(code));
-
+        code = parseAssnStatement();
+        if (code == nullptr) return;
+    }
+    // empty statement
+    else if (cur_token.isTokenSemicolon())
+    {
+        return;
+    }
+    else
+    {
+        syntaxError(cur_token, "expected a statement, got " +
+                               describe(cur_token));
         return;
     }
+
+    if (!expect(Token::TokenType::TOKEN_SEMICOLON, "';'"))
+        return;
+
+    codes.push_back(code);
 }
 
-std::unique_ptr<Statement> Parser::parseAssnStatement()
+Statement *Parser::parseAssnStatement()
 {
     // Allocating new variables
     if (isTokenTypeKeyword(cur_token))
@@ -219,28 +415,29 @@ std::unique_ptr<Statement> Parser::parseAssnStatement()
         Token type_token = cur_token;
 
         advanceTokens();
+        if (!expect(Token::TokenType::TOKEN_IDENTIFIER, "a variable name"))
+            return nullptr;
+
         if (auto [already_defined, type] = isVarAlreadyDefined(cur_token);
             already_defined)
         {
-            std::cerr << "[Error] Re-definition of "
-                      << cur_token.getLiteral() << "\n";
-            std::cerr << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
+            error(cur_token, "redefinition of '" +
+                             std::string(cur_token.getLiteral()) + "'");
         }
 
-        bool is_array = (next_token.isTokenLBracket()) ? 
+        bool is_array = (peekToken(1).isTokenLBracket()) ? 
                         true : false;
 
         recordLocalVars(cur_token, type_token, is_array);
 
-        std::unique_ptr<Expression> iden =
-            std::make_unique<LiteralExpression>(cur_token);
+        Expression *iden = program.make<LiteralExpression>(cur_token);
 
-	std::unique_ptr<Expression> expr;
+	Expression *expr;
         if (!is_array)
         {
             advanceTokens();
-            assert(cur_token.isTokenEqual());
+            if (!expect(Token::TokenType::TOKEN_ASSIGN, "'='"))
+                return nullptr;
 
             advanceTokens();
             expr = parseExpression();
@@ -249,30 +446,39 @@ std::unique_ptr<Statement> Parser::parseAssnStatement()
         {
             expr = parseArrayExpr();
         }
+        if (expr == nullptr) return nullptr;
 	
-        std::unique_ptr<Statement> statement = 
-            std::make_unique<AssnStatement>(iden, expr);
-
-        return statement;
+        return program.make<AssnStatement>(iden, expr);
     }
     else
     {
+        if (!cur_token.isTokenIden())
+        {
+            syntaxError(cur_token, "expected an assignment, got " +
+                                   describe(cur_token));
+            return nullptr;
+        }
+
+        // Without its type, the statement cannot be checked, skip it
         auto [already_defined, type] = isVarAlreadyDefined(cur_token);
         if (!already_defined)
         {
-            std::cerr << "[Error] Undefined variable of "
-                      << cur_token.getLiteral() << "\n";
-            std::cerr << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
+            std::string name(cur_token.getLiteral());
+            syntaxError(cur_token, peekToken(1).isTokenLP()
+                        ? "call to undefined function '" + name + "'"
+                        : "undefined variable '" + name + "'");
+            return nullptr;
         }
 
         cur_expr_type = ValueType::Type::MAX;
         auto iden = parseExpression();
+        if (iden == nullptr) return nullptr;
 
-        assert(cur_token.isTokenEqual());
+        if (!expect(Token::TokenType::TOKEN_ASSIGN, "'='"))
+            return nullptr;
         advanceTokens();
 
-	std::unique_ptr<Expression> expr;
+	Expression *expr;
         if (type == ValueType::Type::INT_ARRAY || 
             type == ValueType::Type::FLOAT_ARRAY)
         {
@@ -287,98 +493,92 @@ std::unique_ptr<Statement> Parser::parseAssnStatement()
         }
 
         expr = parseExpression();
+        if (expr == nullptr) return nullptr;
         
-        std::unique_ptr<Statement> statement = 
-            std::make_unique<AssnStatement>(iden, expr);
-
-        return statement;
+        return program.make<AssnStatement>(iden, expr);
     }
 }
 
-std::unique_ptr<Expression> Parser::parseArrayExpr()
+Expression *Parser::parseArrayExpr()
 {
     advanceTokens();
-    assert(cur_token.isTokenLBracket());
+    if (!expect(Token::TokenType::TOKEN_LBRACKET, "'['"))
+        return nullptr;
 
     advanceTokens();
+    Token num_tok = cur_token;
     // num_ele must be an integer
     auto swap = cur_expr_type;
     cur_expr_type = ValueType::Type::INT;
     auto num_ele = parseExpression();
     cur_expr_type = swap;
-    if (!(num_ele->isExprLiteral()))
-    {
-        std::cerr << "[Error] Number of array elements "
-                  << "must be a single integer. \n"
-                  << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
-    }
-    auto num_ele_lit = static_cast<LiteralExpression*>(num_ele.get());
-    if (!(num_ele_lit->isLiteralInt()))
+    if (num_ele == nullptr) return nullptr;
+
+    int num_eles_int = 0;
+    if (!num_ele->isExprLiteral() ||
+        !static_cast<LiteralExpression*>(num_ele)->isLiteralInt())
     {
-        std::cerr << "[Error] Number of array elements "
-                  << "must be a single integer. \n"
-                  << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
+        error(num_tok, "number of array elements must be a single "
+                       "integer");
     }
-    int num_eles_int = stoi(num_ele_lit->getLiteral());
-    if (num_eles_int <= 1)
+    else
     {
-        std::cerr << "[Error] Number of array elements "
-                  << "must be larger than 1. \n"
-                  << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
+        num_eles_int = 
+            static_cast<LiteralExpression*>(num_ele)->getIntValue();
+        if (num_eles_int <= 1)
+            error(num_tok, "number of array elements must be larger "
+                           "than 1");
     }
 
-    assert(cur_token.isTokenRBracket());
+    if (!expect(Token::TokenType::TOKEN_RBRACKET, "']'"))
+        return nullptr;
 
     advanceTokens();
-    assert(cur_token.isTokenEqual());
+    if (!expect(Token::TokenType::TOKEN_ASSIGN, "'='"))
+        return nullptr;
 
     advanceTokens();
-    assert(cur_token.isTokenLBrace());
+    if (!expect(Token::TokenType::TOKEN_LBRACE, "'{'"))
+        return nullptr;
 
-    std::vector<std::shared_ptr<Expression>> eles;
-    if (!next_token.isTokenRBrace())
+    Token list_tok = cur_token;
+    std::vector<Expression*> eles;
+    advanceTokens();
+    while (!cur_token.isTokenRBrace())
     {
-        advanceTokens();
-        while (!cur_token.isTokenRBrace())
-        {
-            eles.push_back(parseExpression());
-            if (cur_token.isTokenComma())
-                advanceTokens();
-        }
+        auto ele = parseExpression();
+        if (ele == nullptr) return nullptr;
+        eles.push_back(ele);
 
-        // We make sure consistent number of elements
-        if (num_eles_int != eles.size())
-        {
-            std::cerr << "[Error] Accpeted format: "
-                      << "(1) pre-allocation style - array<int> x[10] = {} "
-                      << "(2) #initials == #elements - "
-                      << "array<int> x[2] = {1, 2} \n"
-                      << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
-        }
+        if (cur_token.isTokenComma())
+            advanceTokens();
+        else if (!expect(Token::TokenType::TOKEN_RBRACE, "',' or '}'"))
+            return nullptr;
     }
-    else
+
+    // We make sure consistent number of elements, either
+    // (1) pre-allocation style - array<int> x[10] = {}
+    // (2) #initials == #elements - array<int> x[2] = {1, 2}
+    if (!eles.empty() && num_eles_int > 1 &&
+        size_t(num_eles_int) != eles.size())
     {
-        advanceTokens();
+        error(list_tok, "array of " + std::to_string(num_eles_int) +
+                        " elements initialized with " +
+                        std::to_string(eles.size()) + " values");
     }
 
     advanceTokens();
 
-    std::unique_ptr<Expression> ret = 
-        std::make_unique<ArrayExpression>(num_ele, eles);
-
-    return ret;
+    return program.make<ArrayExpression>(num_ele, program.makeList(eles));
 }
 
-std::unique_ptr<Expression> Parser::parseIndex()
+Expression *Parser::parseIndex()
 {
-    std::unique_ptr<Identifier> iden(new Identifier(cur_token));
+    Identifier *iden = program.make<Identifier>(cur_token);
 
     advanceTokens();
-    assert(cur_token.isTokenLBracket());
+    if (!expect(Token::TokenType::TOKEN_LBRACKET, "'['"))
+        return nullptr;
 
     advanceTokens();
 
@@ -387,458 +587,1005 @@ std::unique_ptr<Expression> Parser::parseIndex()
     cur_expr_type = ValueType::Type::INT;
     auto idx = parseExpression();
     cur_expr_type = swap;
+    if (idx == nullptr) return nullptr;
 
-    std::unique_ptr<Expression> ret = 
-        std::make_unique<IndexExpression>(iden, idx);
-
-    assert(cur_token.isTokenRBracket());
+    if (!expect(Token::TokenType::TOKEN_RBRACKET, "']'"))
+        return nullptr;
 
-    return ret;
+    return program.make<IndexExpression>(iden, idx);
 }
 
-std::unique_ptr<Expression> Parser::parseCall()
+Expression *Parser::parseCall()
 {
-    std::unique_ptr<Identifier> def(new Identifier(cur_token));
+    Identifier *def = program.make<Identifier>(cur_token);
 
     advanceTokens();
-    assert(cur_token.isTokenLP());
+    if (!expect(Token::TokenType::TOKEN_LPAREN, "'('"))
+        return nullptr;
 
     advanceTokens();
-    std::vector<std::shared_ptr<Expression>> args;
+    std::vector<Expression*> args;
 
-    auto &arg_types = getFuncArgTypes(def->getLiteral());
-    unsigned idx = 0;
+    auto &arg_types = getFuncArgTypes(def->getSymbol());
     while (!cur_token.isTokenRP())
     {
-        if (cur_token.isTokenRP())
-            break;
+        if (!args.empty())
+        {
+            if (!expect(Token::TokenType::TOKEN_COMMA, "',' or ')'"))
+                return nullptr;
+            advanceTokens();
+        }
 
+        // Extra arguments are reported below, they have no type to
+        // check against
         auto swap = cur_expr_type;
-        cur_expr_type = arg_types[idx++];
-        args.push_back(parseExpression());
+        cur_expr_type = (args.size() < arg_types.size())
+                        ? arg_types[args.size()]
+                        : ValueType::Type::MAX;
+        auto arg = parseExpression();
         cur_expr_type = swap;
+        if (arg == nullptr) return nullptr;
 
-        if (cur_token.isTokenRP())
-            break;
-        advanceTokens();
+        args.push_back(arg);
     }
 
-    std::unique_ptr<Expression> ret = 
-        std::make_unique<CallExpression>(def, args);
+    if (args.size() != arg_types.size())
+    {
+        error(def->getToken(), "'" + std::string(def->getLiteral()) +
+                               "' takes " +
+                               std::to_string(arg_types.size()) +
+                               " argument(s), got " +
+                               std::to_string(args.size()));
+    }
 
-    return ret;
+    return program.make<CallExpression>(def, program.makeList(args));
 }
 
-std::unique_ptr<Condition> Parser::parseCondition()
+Condition *Parser::parseCondition()
 {
     // The type must be consistent
     auto swap = cur_expr_type;
-    bool is_index = (next_token.isTokenLBracket()) ? 
+    bool is_index = (peekToken(1).isTokenLBracket()) ? 
                     true : false;
     cur_expr_type = getTokenType(cur_token, is_index);
 
     // Left condition
     auto cond_left = parseExpression();
+    if (cond_left == nullptr) return nullptr;
 
     // Comp operator
-    std::string comp_opr_str = cur_token.getLiteral();
-    if (next_token.isTokenEqual())
+    std::string comp_opr_str(cur_token.getLiteral());
+    bool two_tokens = peekToken(1).isTokenEqual();
+    if (two_tokens)
+        comp_opr_str += peekToken(1).getLiteral();
+    if (Condition::strToOperatorType(comp_opr_str) ==
+        Condition::OperatorType::MAX)
     {
-        comp_opr_str += next_token.getLiteral();
-        advanceTokens();
+        syntaxError(cur_token, "expected a comparison operator, got " +
+                               describe(cur_token));
+        return nullptr;
     }
+    if (two_tokens)
+        advanceTokens();
 
     // Right condition
     advanceTokens();
     auto cond_right = parseExpression();
+    if (cond_right == nullptr) return nullptr;
 
     // Build up the condition object
-    std::unique_ptr<Condition> cond = 
-        std::make_unique<Condition>(cond_left,
-                                    cond_right,
-                                    comp_opr_str,
-                                    cur_expr_type);
+    Condition *cond = program.make<Condition>(cond_left,
+                                              cond_right,
+                                              comp_opr_str,
+                                              cur_expr_type);
     cur_expr_type = swap;
 
     return cond;
 }
 
-std::unique_ptr<Statement> Parser::parseIfStatement(std::string& 
-                                                    parent_func_name)
+Statement *Parser::parseIfStatement(Symbol parent_func_name)
 {
     advanceTokens();
-    assert(cur_token.isTokenLP());
+    if (!expect(Token::TokenType::TOKEN_LPAREN, "'('"))
+        return nullptr;
 
     advanceTokens();
     auto cond = parseCondition();
+    if (cond == nullptr) return nullptr;
+    if (!expect(Token::TokenType::TOKEN_RPAREN, "')'"))
+        return nullptr;
 
     // Parse taken block
     advanceTokens();
-    assert(cur_token.isTokenLBrace());
+    if (!expect(Token::TokenType::TOKEN_LBRACE, "'{'"))
+        return nullptr;
 
-    std::vector<std::shared_ptr<Statement>> taken_block_codes;
-    std::unordered_map<std::string,ValueType::Type> taken_block_local_vars;
-    local_vars_tracker.push_back(&taken_block_local_vars);
-    while (true)
-    {
-        advanceTokens();
-        if (cur_token.isTokenRBrace())
-            break;
-
-        parseStatement(parent_func_name, taken_block_codes);
-        // We just finished an if/for statement
-        if (taken_block_codes.back()->isStatementIf() ||
-            taken_block_codes.back()->isStatementFor())
-        {
-            // This RBrace is from the statement,
-            // should not terminate.
-            assert(cur_token.isTokenRBrace());
-        }
-        else
-        {
-            if (cur_token.isTokenRBrace())
-                break;
-        }
-    }
-    assert(cur_token.isTokenRBrace());
-    local_vars_tracker.pop_back();
+    std::vector<Statement*> taken_block_codes;
+    LocalVarTable taken_block_local_vars;
+    var_scopes.enterScope();
+    parseBlock(parent_func_name, taken_block_codes);
+    if (!panic) taken_block_local_vars = program.makeVarTable(var_scopes);
+    var_scopes.exitScope();
+    if (panic) return nullptr;
 
     // Parse else block
-    std::vector<std::shared_ptr<Statement>> not_taken_block_codes;
-    std::unordered_map<std::string,
-                       ValueType::Type> not_taken_block_local_vars;
+    std::vector<Statement*> not_taken_block_codes;
+    LocalVarTable not_taken_block_local_vars;
 
-    if (next_token.isTokenElse())
+    if (peekToken(1).isTokenElse())
     {
         advanceTokens();
-        local_vars_tracker.push_back(&not_taken_block_local_vars);
         advanceTokens();
-        while (true)
-        {
-            advanceTokens();
-            if (cur_token.isTokenRBrace())
-                break;
-
-            parseStatement(parent_func_name, not_taken_block_codes);
-            // We just finished an if/for statement
-            if (not_taken_block_codes.back()->isStatementIf() ||
-                not_taken_block_codes.back()->isStatementFor())
-            {
-                // This RBrace is from the statement,
-                // should not terminate.
-                assert(cur_token.isTokenRBrace());
-            }
-            else
-            {
-                if (cur_token.isTokenRBrace())
-                    break;
-            }
-        }
-        assert(cur_token.isTokenRBrace());
-        local_vars_tracker.pop_back();
+        if (!expect(Token::TokenType::TOKEN_LBRACE, "'{'"))
+            return nullptr;
+
+        var_scopes.enterScope();
+        parseBlock(parent_func_name, not_taken_block_codes);
+        if (!panic)
+            not_taken_block_local_vars = program.makeVarTable(var_scopes);
+        var_scopes.exitScope();
+        if (panic) return nullptr;
     }
 
-    std::unique_ptr<Statement> if_statement = 
-        std::make_unique<IfStatement>(cond, 
-                                      taken_block_codes,
-                                      not_taken_block_codes,
-                                      taken_block_local_vars,
-                                      not_taken_block_local_vars);
+    Statement *if_statement = 
+        program.make<IfStatement>(
+            cond, 
+            program.makeList(taken_block_codes),
+            program.makeList(not_taken_block_codes),
+            taken_block_local_vars,
+            not_taken_block_local_vars);
     
     assert(cur_token.isTokenRBrace());
     return if_statement;
 }
 
-std::unique_ptr<Statement> Parser::parseForStatement(std::string& 
-                                                     parent_func_name)
+Statement *Parser::parseForStatement(Symbol parent_func_name)
 {
-    std::vector<std::shared_ptr<Statement>> block;
-    std::unordered_map<std::string,
-                       ValueType::Type> block_local_vars;
-    local_vars_tracker.push_back(&block_local_vars);
-
-    advanceTokens();
-    assert(cur_token.isTokenLP());
+    std::vector<Statement*> block;
+    var_scopes.enterScope();
 
-    advanceTokens();
-    auto start = parseAssnStatement();
+    Statement *start = nullptr;
+    Condition *end = nullptr;
+    Statement *step = nullptr;
 
+    // for (start; end; step) { block }, stops at the first error
     advanceTokens();
-    auto end = parseCondition();
+    if (expect(Token::TokenType::TOKEN_LPAREN, "'('"))
+    {
+        advanceTokens();
+        start = parseAssnStatement();
+    }
 
-    advanceTokens();
-    auto step = parseAssnStatement();
-    
-    advanceTokens();
-    assert(cur_token.isTokenLBrace());
+    if (start != nullptr && 
+        expect(Token::TokenType::TOKEN_SEMICOLON, "';'"))
+    {
+        advanceTokens();
+        end = parseCondition();
+    }
 
-    while (true)
+    if (end != nullptr &&
+        expect(Token::TokenType::TOKEN_SEMICOLON, "';'"))
     {
         advanceTokens();
-        if (cur_token.isTokenRBrace())
-            break;
+        step = parseAssnStatement();
+    }
 
-        parseStatement(parent_func_name, block);
-        // We just finished an if/for statement
-        if (block.back()->isStatementIf() ||
-            block.back()->isStatementFor())
-        {
-            // This RBrace is from the statement,
-            // should not terminate.
-            assert(cur_token.isTokenRBrace());
-        }
-        else
-        {
-            if (cur_token.isTokenRBrace())
-                break;
-        }
+    if (step != nullptr &&
+        expect(Token::TokenType::TOKEN_RPAREN, "')'"))
+    {
+        advanceTokens();
+        if (expect(Token::TokenType::TOKEN_LBRACE, "'{'"))
+            parseBlock(parent_func_name, block);
     }
+
+    LocalVarTable block_local_vars;
+    if (!panic) block_local_vars = program.makeVarTable(var_scopes);
+    var_scopes.exitScope();
+
+    if (panic) return nullptr;
     
-    std::unique_ptr<Statement> for_statement = 
-        std::make_unique<ForStatement>(start,
-                                       end,
-                                       step,
-                                       block,
-                                       block_local_vars);
+    Statement *for_statement = 
+        program.make<ForStatement>(start,
+                                   end,
+                                   step,
+                                   program.makeList(block),
+                                   block_local_vars);
                                        	       
     assert(cur_token.isTokenRBrace());
-    local_vars_tracker.pop_back();
    
     return for_statement;
 }
 
 
-std::unique_ptr<Expression> Parser::parseExpression()
+Expression *Parser::parseExpression(unsigned min_bp)
 {
-    std::unique_ptr<Expression> left = parseTerm();
+    Expression *left = parsePrefix();
+    if (left == nullptr) return nullptr;
+
+    return parseInfix(left, min_bp);
+}
 
+// Extends left with binary operators that bind tighter than min_bp
+Expression *Parser::parseInfix(Expression *left, unsigned min_bp)
+{
     while (true)
     {
-        if (cur_token.isTokenPlus() || 
-            cur_token.isTokenMinus())
+        // Tokens that are not binary operators have infix_bp 0 and end
+        // the expression
+        auto &op = operator_table[static_cast<uint8_t>(cur_token.type)];
+        if (op.infix_bp <= min_bp)
+            return left;
+
+        advanceTokens();
+        Expression *right = parsePrefix();
+        if (right == nullptr) return nullptr;
+
+        // Only recurse if the next operator binds tighter (e.g., the
+        // b * c of a + b * c)
+        auto &next = operator_table[static_cast<uint8_t>(cur_token.type)];
+        if (next.infix_bp > op.infix_bp)
         {
-            Expression::ExpressionType expr_type;
-            if (cur_token.isTokenPlus())
-            {
-                expr_type = Expression::ExpressionType::PLUS;
-            }
-            else
-            {
-                expr_type = Expression::ExpressionType::MINUS;
-            }
+            right = parseInfix(right, op.infix_bp);
+            if (right == nullptr) return nullptr;
+        }
 
-            advanceTokens();
+        left = program.make<ArithExpression>(left, right, op.type);
+    }
+}
 
-            std::unique_ptr<Expression> right;
+// Prefix operators and () here
+Expression *Parser::parsePrefix()
+{
+    auto &op = operator_table[static_cast<uint8_t>(cur_token.type)];
+    if (op.prefix_bp != 0)
+    {
+        Token zero_tok = (cur_expr_type == ValueType::Type::INT) ? 
+                         Token("0", 0) : Token("0.0", 0.0f);
 
-            // Priority one. ()
-            if (cur_token.isTokenLP())
-            {
-                right = parseTerm();
-                left = std::make_unique<ArithExpression>(left, 
-                       right, 
-                       expr_type);
-                continue;
-            }
-            
-            // Priority two. *, /
-            // check if the next token is a function call
-	    std::unique_ptr<Expression> pending_expr = nullptr;
-            if (auto [is_def, is_built_in] = 
-                    isFuncDef(cur_token.getLiteral());
-                    is_def)
-            {
-                strictTypeCheck(cur_token);
-                pending_expr = parseCall();
-            }
+        Expression *left = program.make<LiteralExpression>(zero_tok);
+        advanceTokens();
 
-            // check if the next token is an array index
-            // TODO - add deref in the future
-            if (bool is_index = (next_token.isTokenLBracket()) ?
-                                true : false;
-                is_index)
-            {
-                assert(pending_expr == nullptr);
-                strictTypeCheck(cur_token, is_index);
-                pending_expr = parseIndex();
-            }
+        Expression *right;
 
-            if (next_token.isTokenAsterisk() ||
-                next_token.isTokenSlash())
-            {
-                if (pending_expr != nullptr)
-                {
-                    advanceTokens();
-                    right = parseTerm(std::move(pending_expr));
-                }
-                else
-                {
-                    right = parseTerm();
-                }
-            }
-            else
-            {
-                if (pending_expr != nullptr)
-                {
-                    right = std::move(pending_expr);
-                }
-                else
-                {
-                    strictTypeCheck(cur_token);
-                    right = std::make_unique<LiteralExpression>(cur_token);
-                }
-                advanceTokens();
-            }
+        // A number right after the sign is taken as is
+        if (cur_token.isTokenInt() || 
+            cur_token.isTokenFloat())
+        {
+            right = program.make<LiteralExpression>(cur_token);
 
-            left = std::make_unique<ArithExpression>(left, 
-                       right, 
-                       expr_type);
+            advanceTokens();
         }
         else
         {
-            return left;
+            right = parsePrefix();
+            if (right == nullptr) return nullptr;
+
+            auto &next = 
+                operator_table[static_cast<uint8_t>(cur_token.type)];
+            if (next.infix_bp > op.prefix_bp)
+            {
+                right = parseInfix(right, op.prefix_bp);
+                if (right == nullptr) return nullptr;
+            }
         }
+
+        return program.make<ArithExpression>(left, right, op.type);
     }
+
+    if (cur_token.isTokenLP())
+    {
+        advanceTokens();
+        Expression *expr = parseExpression();
+        if (expr == nullptr) return nullptr;
+        if (!expect(Token::TokenType::TOKEN_RPAREN, "')'"))
+            return nullptr;
+        advanceTokens();
+        return expr;
+    }
+
+    return parseOperand();
 }
 
-// For Div/Mul
-std::unique_ptr<Expression> Parser::parseTerm(
-    std::unique_ptr<Expression> pending_left)
-{   
-    std::unique_ptr<Expression> left = 
-        (pending_left != nullptr) ? std::move(pending_left) : parseFactor();
+// Literal, variable, array element or call
+Expression *Parser::parseOperand()
+{
+    Expression *operand;
 
-    while (true)
+    if (!cur_token.isTokenIden() &&
+        !cur_token.isTokenInt() &&
+        !cur_token.isTokenFloat())
+    {
+        syntaxError(cur_token, "expected an expression, got " +
+                               describe(cur_token));
+        return nullptr;
+    }
+
+    // TODO - add deref in the future
+    bool is_index = (peekToken(1).isTokenLBracket()) ?
+                    true : false;
+
+    auto [is_def, is_built_in] = isFuncDef(cur_token);
+    if (cur_token.isTokenIden() && !is_def &&
+        !isVarAlreadyDefined(cur_token).first)
     {
-        if (cur_token.isTokenAsterisk() || 
-            cur_token.isTokenSlash())
+        std::string name(cur_token.getLiteral());
+        if (peekToken(1).isTokenLP())
         {
-            Expression::ExpressionType expr_type;
-            if (cur_token.isTokenAsterisk())
-            {
-                expr_type = Expression::ExpressionType::ASTERISK;
-            }
-            else
-            {
-                expr_type = Expression::ExpressionType::SLASH;
-            }
+            syntaxError(cur_token, "call to undefined function '" +
+                                   name + "'");
+            return nullptr;
+        }
+        error(cur_token, "undefined variable '" + name + "'");
+    }
+    else
+    {
+        strictTypeCheck(cur_token, is_index);
+    }
+    
+    if (is_index)
+        operand = parseIndex();
+    else if (is_def)
+        operand = parseCall();
+    else
+        operand = program.make<LiteralExpression>(cur_token);
+    if (operand == nullptr) return nullptr;
 
-            advanceTokens();
+    advanceTokens();
 
-            std::unique_ptr<Expression> right;
+    return operand;
+}
 
-            // We are trying to mul/div something with higher priority
-            if (cur_token.isTokenLP()) 
-            {
-                right = parseTerm();
-            }
-            else
-            {
-                // TODO - add deref in the future
-                bool is_index = (next_token.isTokenLBracket()) ?
-                                true : false;
 
-                strictTypeCheck(cur_token, is_index);
-    
-                if (is_index)
-                    right = parseIndex();
-                else if (auto [is_def, is_built_in] = 
-                            isFuncDef(cur_token.getLiteral());
-                            is_def)
-                    right = parseCall();
-                else
-                    right = std::make_unique<LiteralExpression>(cur_token);
-
-                advanceTokens();
+/************************** Parallel parsing *****************************/
+Parser::Parser(Parser *_owner)
+    : owner(_owner)
+{
+    strings = owner->strings;
+    func_def_tracker = owner->func_def_tracker;
+    line_offset = owner->line_offset;
+}
+
+// The language has no globals: once every signature is known, the body
+// of a function can be parsed without looking at any other function.
+// Records the signature of every function in toks and its token range.
+// Returns false, recording nothing, unless toks is a clean sequence of
+//     type name ( [type name {, type name}] ) { ... }
+// with balanced braces and no function defined twice.
+bool Parser::splitFunctions(std::vector<Token> &toks,
+                            std::vector<FuncRange> &ranges)
+{
+    size_t n = toks.size();
+    auto is = [&](size_t i, Token::TokenType type)
+    {
+        return i < n && toks[i].type == type;
+    };
+
+    std::vector<std::pair<Symbol, FuncRecord>> records;
+    std::vector<bool> seen(strings->size(), false);
+
+    size_t i = 0;
+    while (i < n)
+    {
+        FuncRange range;
+        range.begin = i;
+
+        FuncRecord record;
+        record.ret_type = ValueType::typeTokenToValueType(toks[i]);
+        record.is_defined = true;
+        if (record.ret_type == ValueType::Type::MAX ||
+            !is(i + 1, Token::TokenType::TOKEN_IDENTIFIER) ||
+            !is(i + 2, Token::TokenType::TOKEN_LPAREN))
+            return false;
+
+        Symbol sym = toks[i + 1].getSymbol();
+        if (seen[sym] || findFuncDef(sym) != nullptr)
+            return false;
+        seen[sym] = true;
+
+        // arguments
+        i += 3;
+        while (!is(i, Token::TokenType::TOKEN_RPAREN))
+        {
+            if (!record.arg_types.empty())
+            {
+                if (!is(i, Token::TokenType::TOKEN_COMMA)) return false;
+                i++;
             }
+            if (i >= n) return false;
 
-            left = std::make_unique<ArithExpression>(left, 
-                       right, 
-                       expr_type);
+            auto type = ValueType::strToValueType(toks[i].getLiteral());
+            if (type == ValueType::Type::MAX ||
+                !is(i + 1, Token::TokenType::TOKEN_IDENTIFIER))
+                return false;
 
+            record.arg_types.push_back(type);
+            i += 2;
         }
-        else
+
+        // body, up to the matching brace
+        i++;
+        if (!is(i, Token::TokenType::TOKEN_LBRACE)) return false;
+        unsigned depth = 0;
+        for (; i < n; i++)
         {
-            break;
+            if (toks[i].isTokenLBrace())
+                depth++;
+            else if (toks[i].isTokenRBrace() && --depth == 0)
+                break;
         }
+        if (i == n) return false;
 
+        range.end = ++i;
+        ranges.push_back(range);
+        records.emplace_back(sym, record);
     }
 
-    return left;
+    for (auto &[sym, record] : records)
+    {
+        if (sym >= func_def_tracker.size()) func_def_tracker.resize(sym + 1);
+        func_def_tracker[sym] = record;
+    }
+    return true;
 }
 
-// Deal with () here
-std::unique_ptr<Expression> Parser::parseFactor()
+// Parses the rest of the current token stream: the signatures are
+// recorded in one serial pass, then worker parsers (one per thread, each
+// with its own arena) take the bodies FUNCS_PER_TASK at a time. With one
+// thread the only worker runs in this one. Errors are reported in source
+// order. Input that does not split cleanly is parsed serially instead,
+// which reports what is wrong with it (a call is then only checked
+// against the functions before it).
+std::vector<Statement*> Parser::parseFunctionsParallel()
 {
-    std::unique_ptr<Expression> left;
+    std::vector<Token> toks;
+    toks.reserve(lexer->getSourceSize() / 8);
+    tokens->drain(toks);
+    cur_token = tokens->peek();
 
-    if (cur_token.isTokenMinus())
+    std::vector<FuncRange> ranges;
+    if (!splitFunctions(toks, ranges))
     {
-        Expression::ExpressionType expr_type = 
-	    Expression::ExpressionType::MINUS;
+        tokens = std::make_unique<TokenStream>(toks.data(),
+                                               toks.data() + toks.size());
+        cur_token = tokens->peek();
+        brace_depth = 0;
+
+        auto funcs = parseFunctions();
+        tokens.reset();
+        return funcs;
+    }
 
-	
-        Token::TokenType tok_type = (cur_expr_type == ValueType::Type::INT) ? 
-                                    Token::TokenType::TOKEN_INT : 
-                                    Token::TokenType::TOKEN_FLOAT;
-        std::string tok_lit = (cur_expr_type == ValueType::Type::INT) ? 
-                              "0" : "0.0";
-        Token zero_tok(tok_type, tok_lit);
-
-        std::unique_ptr<Expression> left_expr = 
-            std::make_unique<LiteralExpression>(zero_tok);
-        advanceTokens();
+    size_t num_funcs = ranges.size();
+    if (on_function)
+    {
+        // Pipelined, one function at a time
+        Parser worker(this);
+        for (auto &range : ranges)
+        {
+            auto func = worker.parseFunctionAt(toks.data() + range.begin,
+                                               toks.data() + range.end);
+            diags.append(worker.diags);
+            worker.diags.clear();
+            if (func != nullptr && !diags.hasErrors())
+                on_function(this, func);
+
+            // Only the signature outlives a pipelined function
+            worker.program.getArena().reset();
+        }
+        return {};
+    }
 
-        std::unique_ptr<Expression> right_expr;
+    std::vector<Statement*> funcs(num_funcs, nullptr);
+    std::vector<Diagnostics> func_diags(num_funcs);
 
-        if (cur_token.isTokenInt() || 
-            cur_token.isTokenFloat())
+    unsigned num_threads = std::max<size_t>(
+        1, std::min<size_t>(parse_threads, num_funcs));
+    std::vector<std::unique_ptr<Parser>> workers;
+    for (unsigned i = 0; i < num_threads; i++)
+        workers.emplace_back(new Parser(this));
+
+    std::atomic<size_t> next_func(0);
+    auto work = [&](Parser *worker)
+    {
+        while (true)
         {
-            right_expr = 
-                std::make_unique<LiteralExpression>(cur_token);
+            size_t begin = next_func.fetch_add(FUNCS_PER_TASK);
+            if (begin >= num_funcs) break;
 
-            advanceTokens();
+            size_t end = std::min(begin + FUNCS_PER_TASK, num_funcs);
+            for (size_t f = begin; f < end; f++)
+            {
+                funcs[f] = worker->parseFunctionAt(
+                    toks.data() + ranges[f].begin,
+                    toks.data() + ranges[f].end);
+
+                if (worker->diags.hasErrors())
+                {
+                    func_diags[f] = std::move(worker->diags);
+                    worker->diags.clear();
+                }
+            }
         }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; i++)
+        threads.emplace_back(work, workers[i].get());
+    work(workers[0].get());
+    for (auto &thread : threads) thread.join();
+
+    // The AST nodes stay in the workers' arenas
+    for (auto &worker : workers)
+        program.adoptArena(std::move(worker->program.getArena()));
+
+    std::vector<Statement*> parsed;
+    func_starts.clear();
+    for (size_t f = 0; f < num_funcs; f++)
+    {
+        diags.append(func_diags[f]);
+        if (funcs[f] == nullptr) continue;
+
+        parsed.push_back(funcs[f]);
+        func_starts.push_back(toks[ranges[f].begin].text);
+    }
+    return parsed;
+}
+
+// Parses the function made of tokens [begin, end)
+Statement *Parser::parseFunctionAt(const Token *begin, const Token *end)
+{
+    if (tokens == nullptr)
+        tokens = std::make_unique<TokenStream>(begin, end);
+    else
+        tokens->reset(begin, end);
+    cur_token = tokens->peek();
+    brace_depth = 0;
+    panic = false;
+
+    return parseFunction();
+}
+
+
+/************************ Incremental reparsing **************************/
+void Parser::buildPieces()
+{
+    // The current lexer holds the whole file and func_starts has the
+    // first token of every function in program order.
+    auto src = lexer->getSource();
+    size_t num_funcs = func_starts.size();
+    auto start = [&](size_t i)
+    {
+        return (i < num_funcs) ? size_t(func_starts[i] - src.data())
+                               : src.size();
+    };
+
+    pieces.clear();
+    pieces.emplace_back(src.substr(0, start(0)));
+    for (size_t i = 0; i < num_funcs; i++)
+        pieces.emplace_back(src.substr(start(i), start(i + 1) - start(i)));
+
+    piece_ends.clear();
+    piece_end_lines.clear();
+    size_t pos = 0;
+    uint32_t lines = 0;
+    for (auto &piece : pieces)
+    {
+        pos += piece.size();
+        lines += std::count(piece.begin(), piece.end(), '\n');
+        piece_ends.push_back(pos);
+        piece_end_lines.push_back(lines);
+    }
+
+    assignOrder(0, program.getStatements().size());
+}
+
+std::string Parser::getSource()
+{
+    if (pieces.empty()) return std::string(lexer->getSource());
+
+    std::string src;
+    src.reserve(piece_ends.back());
+    for (auto &piece : pieces) src += piece;
+    return src;
+}
+
+uint64_t &Parser::funcOrder(size_t stmt)
+{
+    auto func = static_cast<FuncStatement*>(program.getStatements()[stmt]);
+    return func_def_tracker[func->getFuncSymbol()].order;
+}
+
+// Gives statements [begin, end) order keys evenly spread between the keys
+// of their neighbours, renumbering every function if there is no room
+void Parser::assignOrder(size_t begin, size_t end)
+{
+    size_t num_stmts = program.getStatements().size();
+    if (begin == end) return;
+
+    uint64_t lower = (begin == 0) ? 0 : funcOrder(begin - 1);
+    uint64_t upper = (end < num_stmts) ?
+                     funcOrder(end) : lower + (end - begin + 1) * ORDER_GAP;
+    uint64_t step = (upper - lower) / (end - begin + 1);
+    if (step == 0)
+    {
+        begin = 0;
+        end = num_stmts;
+        lower = 0;
+        step = ORDER_GAP;
+    }
+
+    for (size_t i = begin; i < end; i++)
+        funcOrder(i) = lower + (i - begin + 1) * step;
+}
+
+// Index of the statement defining func_sym, by its order key
+size_t Parser::findStatement(Symbol func_sym)
+{
+    uint64_t order = func_def_tracker[func_sym].order;
+
+    size_t lo = 0;
+    size_t hi = program.getStatements().size();
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (funcOrder(mid) < order)
+            lo = mid + 1;
         else
-        {
-            right_expr = parseFactor();
-        }
+            hi = mid;
+    }
+    assert(lo < program.getStatements().size() && funcOrder(lo) == order);
+    return lo;
+}
+
+// Callee of every call in an expression, statement or block
+static void collectCalls(Expression *expr,
+                         std::vector<StringInterner::Symbol> &callees);
 
-        left = std::make_unique<ArithExpression>(left_expr, 
-                                                 right_expr,
-                                                 expr_type);
-        return left;
+static void collectCalls(Condition *cond,
+                         std::vector<StringInterner::Symbol> &callees)
+{
+    collectCalls(cond->getLeft(), callees);
+    collectCalls(cond->getRight(), callees);
+}
+
+static void collectCalls(Expression *expr,
+                         std::vector<StringInterner::Symbol> &callees)
+{
+    if (expr->isExprArith())
+    {
+        auto arith = static_cast<ArithExpression*>(expr);
+        collectCalls(arith->getLeft(), callees);
+        collectCalls(arith->getRight(), callees);
+    }
+    else if (expr->isExprArray())
+    {
+        auto array = static_cast<ArrayExpression*>(expr);
+        for (auto ele : array->getElements()) collectCalls(ele, callees);
     }
+    else if (expr->isExprIndex())
+    {
+        auto index = static_cast<IndexExpression*>(expr);
+        collectCalls(index->getIndex(), callees);
+    }
+    else if (expr->isExprCall())
+    {
+        auto call = static_cast<CallExpression*>(expr);
+        callees.push_back(call->getCallFuncSymbol());
+        for (auto arg : call->getArgs()) collectCalls(arg, callees);
+    }
+}
 
-    if (cur_token.isTokenLP())
+static void collectCalls(Statement *stmt,
+                         std::vector<StringInterner::Symbol> &callees)
+{
+    if (stmt->isStatementFunc())
     {
-        advanceTokens();
-        left = parseExpression();
-        assert(cur_token.isTokenRP()); // Error checking
-        advanceTokens();
-        return left;
+        auto func = static_cast<FuncStatement*>(stmt);
+        for (auto code : func->getFuncCodes()) collectCalls(code, callees);
     }
-    
-    // TODO - add deref in the future
-    bool is_index = (next_token.isTokenLBracket()) ?
-                    true : false;
+    else if (stmt->isStatementAssn())
+    {
+        auto assn = static_cast<AssnStatement*>(stmt);
+        collectCalls(assn->getIden(), callees);
+        collectCalls(assn->getExpr(), callees);
+    }
+    else if (stmt->isStatementRet())
+    {
+        collectCalls(static_cast<RetStatement*>(stmt)->getRetVal(), callees);
+    }
+    else if (stmt->isStatementBuiltinCall() || stmt->isStatementNormalCall())
+    {
+        collectCalls(static_cast<CallStatement*>(stmt)->getCallExpr(),
+                     callees);
+    }
+    else if (stmt->isStatementIf())
+    {
+        auto if_s = static_cast<IfStatement*>(stmt);
+        collectCalls(if_s->getCond(), callees);
+        for (auto code : if_s->getTakenBlock()) collectCalls(code, callees);
+        for (auto code : if_s->getNotTakenBlock())
+            collectCalls(code, callees);
+    }
+    else if (stmt->isStatementFor())
+    {
+        auto for_s = static_cast<ForStatement*>(stmt);
+        collectCalls(for_s->getStart(), callees);
+        collectCalls(for_s->getEnd(), callees);
+        collectCalls(for_s->getStep(), callees);
+        for (auto code : for_s->getBlock()) collectCalls(code, callees);
+    }
+}
 
-    strictTypeCheck(cur_token, is_index);
-    
-    if (is_index)
-        left = parseIndex();
-    else if (auto [is_def, is_built_in] = 
-                 isFuncDef(cur_token.getLiteral());
-                 is_def)
-        left = parseCall();
+// Adds (delta 1) or takes out (delta -1) the calls func makes
+void Parser::countCalls(Statement *func, int delta)
+{
+    Symbol caller = static_cast<FuncStatement*>(func)->getFuncSymbol();
+
+    std::vector<Symbol> callees;
+    collectCalls(func, callees);
+    for (auto callee : callees)
+    {
+        if (callee >= func_callers.size()) func_callers.resize(callee + 1);
+        auto &count = func_callers[callee][caller];
+        count += delta;
+        if (count == 0) func_callers[callee].erase(caller);
+    }
+}
+
+void Parser::buildCallers()
+{
+    func_callers.assign(strings->size(), {});
+    for (auto func : program.getStatements()) countCalls(func, 1);
+    have_callers = true;
+}
+
+// Relexes and reparses pieces [first, last], whose text is now region,
+// and splices the functions in. Returns the number of functions parsed;
+// the replaced functions whose signature changed or that are gone are
+// added to changed (also on errors, when nothing is spliced in and the
+// caller reports them).
+size_t Parser::reparsePieces(size_t first, size_t last, std::string &&region,
+                             std::vector<Symbol> &changed)
+{
+    // pieces[i] holds statement i - 1, pieces[0] has no function
+    auto &statements = program.getStatements();
+    size_t stmt_begin = (first == 0) ? 0 : first - 1;
+    size_t stmt_end = last;
+
+    // Errors in the region are reported at their line in the whole file
+    line_offset = (first == 0) ? 0 : piece_end_lines[first - 1];
+
+    // (2) forget the functions being replaced, keeping their signatures
+    // to compare. The region sees every other function, like a full
+    // parse.
+    std::vector<std::pair<Symbol, FuncRecord>> replaced;
+    for (size_t i = stmt_begin; i < stmt_end; i++)
+    {
+        auto func = static_cast<FuncStatement*>(statements[i]);
+        auto &record = func_def_tracker[func->getFuncSymbol()];
+        replaced.emplace_back(func->getFuncSymbol(), record);
+        record.is_defined = false;
+    }
+
+    // (3) lex and parse the region on its own. The previous lexer stays
+    // alive, the untouched functions and the interner point into it.
+    retired_bytes += lexer->getSourceSize();
+    retired_lexers.push_back(std::move(lexer));
+    lexer = std::make_unique<Lexer>(std::move(region), strings);
+    tokens = std::make_unique<TokenStream>(lexer.get());
+    cur_token = tokens->peek();
+    brace_depth = 0;
+
+    auto funcs = parseFunctionsParallel();
+
+    for (auto &[sym, old] : replaced)
+    {
+        auto &record = func_def_tracker[sym];
+        if (!record.is_defined ||
+            record.ret_type != old.ret_type ||
+            record.arg_types != old.arg_types)
+            changed.push_back(sym);
+
+        // On errors the old statements stay, and findStatement() still
+        // looks them up by their order key
+        record.order = old.order;
+    }
+    if (diags.hasErrors()) return 0;
+
+    // Calls made by the old functions are still in the AST
+    if (!changed.empty() && !have_callers) buildCallers();
+    if (have_callers)
+    {
+        for (size_t i = stmt_begin; i < stmt_end; i++)
+            countCalls(statements[i], -1);
+        for (auto func : funcs) countCalls(func, 1);
+    }
+
+    // (4) splice the new functions and their text in. Text before the
+    // first function (blank lines, comments) goes to the piece before.
+    auto src = lexer->getSource();
+    size_t num_funcs = func_starts.size();
+    auto start = [&](size_t i)
+    {
+        return (i < num_funcs) ? size_t(func_starts[i] - src.data())
+                               : src.size();
+    };
+
+    std::vector<std::string> new_pieces;
+    if (first == 0)
+        new_pieces.emplace_back(src.substr(0, start(0)));
     else
-        left = std::make_unique<LiteralExpression>(cur_token);
+        pieces[first - 1] += src.substr(0, start(0));
+    for (size_t i = 0; i < num_funcs; i++)
+        new_pieces.emplace_back(src.substr(start(i), start(i + 1) - start(i)));
+
+    size_t old_end = piece_ends[last];
+    uint32_t old_end_lines = piece_end_lines[last];
+
+    size_t piece_begin = (first == 0) ? 0 : first;
+    size_t piece_end = piece_begin + new_pieces.size();
+    pieces.erase(pieces.begin() + piece_begin, pieces.begin() + last + 1);
+    pieces.insert(pieces.begin() + piece_begin,
+                  std::make_move_iterator(new_pieces.begin()),
+                  std::make_move_iterator(new_pieces.end()));
+
+    piece_ends.erase(piece_ends.begin() + piece_begin,
+                     piece_ends.begin() + last + 1);
+    piece_ends.insert(piece_ends.begin() + piece_begin,
+                      new_pieces.size(), 0);
+    piece_end_lines.erase(piece_end_lines.begin() + piece_begin,
+                          piece_end_lines.begin() + last + 1);
+    piece_end_lines.insert(piece_end_lines.begin() + piece_begin,
+                           new_pieces.size(), 0);
+
+    // Sizes of the pieces that changed (including the one before, which
+    // may have grown), the ones after just move
+    size_t changed_begin = (first == 0) ? 0 : first - 1;
+    size_t pos = (changed_begin == 0) ? 0 : piece_ends[changed_begin - 1];
+    uint32_t lines =
+        (changed_begin == 0) ? 0 : piece_end_lines[changed_begin - 1];
+    for (size_t i = changed_begin; i < piece_end; i++)
+    {
+        pos += pieces[i].size();
+        lines += std::count(pieces[i].begin(), pieces[i].end(), '\n');
+        piece_ends[i] = pos;
+        piece_end_lines[i] = lines;
+    }
 
-    advanceTokens();
+    int64_t byte_delta = int64_t(pos) - int64_t(old_end);
+    int64_t line_delta = int64_t(lines) - int64_t(old_end_lines);
+    for (size_t i = piece_end; i < pieces.size(); i++)
+    {
+        piece_ends[i] += byte_delta;
+        piece_end_lines[i] += line_delta;
+    }
 
-    return left;
+    program.replaceStatements(stmt_begin, stmt_end, funcs);
+    assignOrder(stmt_begin, stmt_begin + funcs.size());
+
+    return num_funcs;
 }
 
+size_t Parser::applyEdit(size_t offset, size_t length, std::string_view text)
+{
+    if (pieces.empty()) buildPieces();
+
+    size_t total = piece_ends.back();
+    if (offset > total || length > total - offset)
+    {
+        std::cerr << "[Error] applyEdit: edit [" << offset << ", "
+                  << offset + length << ") is outside the source ("
+                  << total << " bytes)\n";
+        exit(1);
+    }
+
+    // (1) find the pieces the edit touches, an insertion touches the
+    // piece it lands in (or the last one at the end of the file)
+    size_t last_byte = (length != 0) ? offset + length - 1 : offset;
+    auto pieceAt = [&](size_t pos)
+    {
+        size_t i = std::upper_bound(piece_ends.begin(), piece_ends.end(),
+                                    pos) - piece_ends.begin();
+        return std::min(i, pieces.size() - 1);
+    };
+    size_t first = pieceAt(offset);
+    size_t last = pieceAt(last_byte);
+    size_t region_begin = (first == 0) ? 0 : piece_ends[first - 1];
+
+    std::string region;
+    for (size_t i = first; i <= last; i++) region += pieces[i];
+    region.replace(offset - region_begin, length, text);
+
+    std::vector<Symbol> changed;
+    size_t stmt_begin = (first == 0) ? 0 : first - 1;
+    size_t num_funcs = reparsePieces(first, last, std::move(region), changed);
+    // Statements holding the region, the old ones if it has errors
+    size_t stmt_end = diags.hasErrors() ? last : stmt_begin + num_funcs;
+
+    // (5) functions calling one whose signature changed or that is gone
+    // are checked again, against what the edit left, as a full parse
+    // would (even when the region has errors of its own)
+    if (!changed.empty() && !have_callers) buildCallers();
+
+    std::vector<size_t> callers;
+    for (auto callee : changed)
+    {
+        if (callee >= func_callers.size()) continue;
+        for (auto &[caller, count] : func_callers[callee])
+        {
+            size_t i = findStatement(caller);
+            if (i < stmt_begin || i >= stmt_end) callers.push_back(i);
+        }
+    }
+    std::sort(callers.begin(), callers.end());
+    callers.erase(std::unique(callers.begin(), callers.end()),
+                  callers.end());
+
+    auto &statements = program.getStatements();
+    if (!diags.hasErrors() && callers.size() > statements.size() / 4)
+    {
+        // Cheaper to start over
+        rebuild(getSource());
+        return statements.size();
+    }
+
+    // Errors are reported in source order, the region's after those of
+    // the callers before it
+    Diagnostics region_diags = diags;
+    diags.clear();
+    for (auto i : callers)
+    {
+        if (i >= stmt_begin && region_diags.hasErrors())
+        {
+            diags.append(region_diags);
+            region_diags.clear();
+        }
+
+        // Same text, so the same single function (or errors)
+        std::vector<Symbol> unchanged;
+        std::string caller_text = pieces[i + 1];
+        num_funcs += reparsePieces(i + 1, i + 1, std::move(caller_text),
+                                   unchanged);
+        assert(unchanged.empty());
+    }
+    diags.append(region_diags);
+    reportErrors();
+
+    // (6) retired buffers only ever grow, start over from a single
+    // buffer once they outweigh the source itself
+    if (retired_bytes > piece_ends.back() + (1 << 16)) rebuild(getSource());
+
+    return num_funcs;
+}
+
+void Parser::rebuild(std::string &&text)
+{
+    // The AST and the symbol table point into the old buffers, drop
+    // them first.
+    program = Program();
+    func_def_tracker.clear();
+    pieces.clear();
+    piece_ends.clear();
+    piece_end_lines.clear();
+    func_callers.clear();
+    have_callers = false;
+
+    tokens.reset();
+    lexer = std::make_unique<Lexer>(std::move(text));
+    retired_lexers.clear();
+    retired_bytes = 0;
+    line_offset = 0;
+    brace_depth = 0;
+
+    strings = &lexer->getStrings();
+    tokens = std::make_unique<TokenStream>(lexer.get());
+    cur_token = tokens->peek();
+
+    recordBuiltins();
+
+    parseProgram();
+    reportErrors();
+}
 
 void RetStatement::printStatement()
 {
@@ -974,7 +1721,7 @@ void Condition::printStatement()
         std::cout << "      " << left->print(3) << "\n";
     else
         std::cout << left->print(3) << "\n";
-    std::cout << "    [COMP] " << opr_type_str << "\n\n";
+    std::cout << "    [COMP] " << getOpr() << "\n\n";
     std::cout << "    [Right]\n";
     if (right->getType() == Expression::ExpressionType::LITERAL) 
         std::cout << "      " << right->print(3) << "\n";
@@ -982,4 +1729,85 @@ void Condition::printStatement()
         std::cout << right->print(3) << "\n";
     std::cout << "  }\n";
 }
+
+/*************************** AST cache ***********************************/
+bool Parser::loadAst(const std::string &fn, uint64_t content_hash)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto loaded = std::make_unique<AstCache>();
+    if (!loaded->load(fn, content_hash, lexer->getSource()))
+    {
+        AstCache::stats.misses++;
+        return false;
+    }
+
+    // Interning in the original order reproduces the symbol ids
+    assert(strings->size() == 0);
+    for (size_t i = 0; i < loaded->numStrings(); i++)
+    {
+        [[maybe_unused]] auto sym = strings->intern(loaded->string(i));
+        assert(sym == i);
+    }
+
+    FlatAst ast;
+    loaded->fill(ast);
+    Program loaded_program;
+    ast.toProgram(loaded_program);
+
+    // Signatures, as parseFunction() would have recorded them
+    recordBuiltins();
+    std::vector<FuncStatement::Argument> args;
+    for (auto statement : loaded_program.getStatements())
+    {
+        auto func = static_cast<FuncStatement*>(statement);
+        auto &func_args = func->getFuncArgs();
+        args.assign(func_args.begin(), func_args.end());
+        recordDefs(func->getFuncSymbol(), func->getRetType(), args);
+    }
+
+    // The cache holds no errors, but the rules a call resolves by are
+    // not part of its key: check again that every callee is defined, and
+    // parse instead if one is not. (The interner points into the cache
+    // now, it has to stay.)
+    ast_cache = std::move(loaded);
+    std::vector<Symbol> callees;
+    for (auto statement : loaded_program.getStatements())
+        collectCalls(statement, callees);
+    for (auto callee : callees)
+    {
+        if (findFuncDef(callee) == nullptr)
+        {
+            func_def_tracker.clear();
+            AstCache::stats.misses++;
+            return false;
+        }
+    }
+
+    program = std::move(loaded_program);
+    for (size_t i = 0; i < ast_cache->numFuncs(); i++)
+        func_starts.push_back(ast_cache->funcStart(i));
+
+    AstCache::stats.hits++;
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    AstCache::stats.seconds += elapsed.count();
+
+    return true;
+}
+
+void Parser::storeAst(const std::string &fn, uint64_t content_hash)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    FlatAst ast(program);
+    if (AstCache::store(fn, content_hash, lexer->getSource(), ast,
+                        func_starts, *strings))
+        AstCache::stats.writes++;
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    AstCache::stats.seconds += elapsed.count();
+}
 }
@@ -2,11 +2,21 @@
 #define __PARSER_HH__
 
 #include "lexer/lexer.hh"
+#include "lexer/token_stream.hh"
+#include "parser/arena.hh"
+#include "parser/diagnostics.hh"
+#include "parser/scoped_table.hh"
 
+#include <array>
 #include <cassert>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <variant>
+#include <vector>
 
 namespace Frontend
 {
@@ -66,7 +76,7 @@ class ValueType
         }
     }
 
-    static Type strToValueType(std::string _type)
+    static Type strToValueType(std::string_view _type)
     {
         if (_type == "void")
             return ValueType::Type::VOID;
@@ -79,6 +89,93 @@ class ValueType
     }
 };
 
+// Interned identifier, see StringInterner
+using Symbol = StringInterner::Symbol;
+
+// Types of the variables in scope while parsing, one scope per block
+using VarScopes = ScopedTable<ValueType::Type>;
+
+// Frozen copy of the variables declared in one block, stored in the AST.
+// It is an open-addressing table in the program's arena, so the nodes
+// holding it stay trivially destructible.
+class LocalVarTable
+{
+  public:
+    struct Slot
+    {
+        Symbol sym;
+        ValueType::Type type;
+    };
+
+  protected:
+    // power-of-two number of slots, empty if the block has no variables
+    ArenaList<Slot> slots;
+    uint32_t num_vars = 0;
+
+    static size_t hash(Symbol sym) { return sym * 0x9E3779B1u; }
+
+  public:
+    LocalVarTable() {}
+
+    // The variables bound in the innermost scope of vars
+    LocalVarTable(Arena &arena, const VarScopes &vars)
+        : LocalVarTable(arena, vars.scopeEnd() - vars.scopeBegin(),
+                        [&vars](size_t i)
+                        {
+                            auto &var = vars.scopeBegin()[i];
+                            return Slot{var.sym, var.value};
+                        })
+    {}
+
+    // count variables, var(i) returns the i-th one as a Slot
+    template<typename Var>
+    LocalVarTable(Arena &arena, size_t count, Var &&var)
+    {
+        if (count == 0) return;
+
+        size_t cap = 4;
+        while (cap < count * 2) cap *= 2;
+
+        slots = ArenaList<Slot>(arena, cap);
+        for (auto &slot : slots)
+            slot = Slot{StringInterner::INVALID_SYMBOL, ValueType::Type::MAX};
+        for (size_t v = 0; v < count; v++)
+        {
+            Slot slot = var(v);
+            size_t i = hash(slot.sym) & (cap - 1);
+            while (slots[i].sym != StringInterner::INVALID_SYMBOL)
+                i = (i + 1) & (cap - 1);
+            slots[i] = slot;
+        }
+        num_vars = count;
+    }
+
+    // nullptr if sym is not declared in this block
+    const ValueType::Type *find(Symbol sym) const
+    {
+        if (slots.empty()) return nullptr;
+
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(sym) & mask; ; i = (i + 1) & mask)
+        {
+            if (slots[i].sym == sym) return &slots[i].type;
+            if (slots[i].sym == StringInterner::INVALID_SYMBOL) 
+                return nullptr;
+        }
+    }
+
+    size_t size() const { return num_vars; }
+
+    // All slots, unused ones have sym == INVALID_SYMBOL
+    auto &getSlots() const { return slots; }
+};
+
+/*
+ * AST nodes live in the Program's arena (see arena.hh). They are linked
+ * by raw pointers, lists of children are ArenaLists, and none of them
+ * needs a destructor: the whole tree goes away with the arena.
+ * */
+
 /* Identifier definition */
 class Identifier
 {
@@ -86,17 +183,17 @@ class Identifier
     Token tok;
 
   public:
-    Identifier(const Identifier &_iden) : tok(_iden.tok) {}
-
     Identifier(Token &_tok) : tok(_tok) {}
 
     virtual std::string print()
     {
-        return tok.getLiteral();
+        return std::string(tok.getLiteral());
     }
 
-    auto &getLiteral() { return tok.getLiteral(); }
+    auto getLiteral() { return tok.getLiteral(); }
+    auto getSymbol() { return tok.getSymbol(); }
     auto getType() { return tok.prinTokenType(); }
+    auto &getToken() { return tok; }
 };
 
 /* Expression definition */
@@ -148,57 +245,48 @@ class LiteralExpression : public Expression
     Token tok;
     
   public:
-    LiteralExpression(const LiteralExpression &_expr) 
-    {
-        tok = _expr.tok;
-        type = ExpressionType::LITERAL;
-    }
-
     LiteralExpression(Token &_tok) : tok(_tok) 
     {
         type = ExpressionType::LITERAL;
     }
 
-    std::string& getLiteral() { return tok.getLiteral(); }
+    auto getLiteral() { return tok.getLiteral(); }
+    // Only meaningful for identifiers
+    auto getSymbol() { return tok.getSymbol(); }
+    auto &getToken() { return tok; }
+
+    auto getIntValue() { return tok.getIntValue(); }
+    auto getFloatValue() { return tok.getFloatValue(); }
 
+    bool isLiteralIden() { return tok.isTokenIden(); }
     bool isLiteralInt() { return tok.isTokenInt(); }
     bool isLiteralFloat() { return tok.isTokenFloat(); }
 
     // Debug print associated with the print in ArithExp
     std::string print(unsigned level) override
     {
-        return (tok.getLiteral() + "\n");
+        return (std::string(tok.getLiteral()) + "\n");
     }
 };
 
 class ArithExpression : public Expression
 {
   protected:
-    // Unique is also good but it will incur errors when
-    // invoking copy constructors
-    std::shared_ptr<Expression> left;
-    std::shared_ptr<Expression> right;
+    Expression *left;
+    Expression *right;
 
   public:
-    // unique can be easily converted to shared
-    ArithExpression(std::unique_ptr<Expression> &_left,
-                    std::unique_ptr<Expression> &_right,
+    ArithExpression(Expression *_left,
+                    Expression *_right,
                     ExpressionType _type)
+        : left(_left)
+        , right(_right)
     {
-        left = std::move(_left);
-        right = std::move(_right);
         type = _type;
     }
 
-    ArithExpression(const ArithExpression &_expr)
-    {
-        left = std::move(_expr.left);
-        right = std::move(_expr.right);
-        type = _expr.type;
-    }
-
-    auto getLeft() { return left.get(); }
-    auto getRight() { return right.get(); }
+    auto getLeft() { return left; }
+    auto getRight() { return right; }
 
     char getOperator()
     {
@@ -275,26 +363,19 @@ class ArithExpression : public Expression
 class ArrayExpression : public Expression
 {
   protected:
-    std::shared_ptr<Expression> num_ele;
-    std::vector<std::shared_ptr<Expression>> eles;
+    Expression *num_ele;
+    ArenaList<Expression*> eles;
 
   public:
-    ArrayExpression(std::unique_ptr<Expression> &_num_ele,
-                    std::vector<std::shared_ptr<Expression>> &_eles)
+    ArrayExpression(Expression *_num_ele,
+                    ArenaList<Expression*> _eles)
+        : num_ele(_num_ele)
+        , eles(_eles)
     {
-        num_ele = std::move(_num_ele);
-        eles = std::move(_eles);
         type = ExpressionType::ARRAY;
     }
-
-    ArrayExpression(const ArrayExpression &_expr)
-    {
-        num_ele = std::move(_expr.num_ele);
-        eles = std::move(_expr.eles);
-        type = _expr.type;
-    }
    
-    auto getNumElements() { return num_ele.get(); }
+    auto getNumElements() { return num_ele; }
     auto &getElements() { return eles; }
 
     std::string print(unsigned level) override
@@ -330,36 +411,29 @@ class ArrayExpression : public Expression
 class IndexExpression : public Expression
 {
   protected:
-    std::shared_ptr<Identifier> iden;
-    std::shared_ptr<Expression> idx;
+    Identifier *iden;
+    Expression *idx;
 
   public:
-    IndexExpression(std::unique_ptr<Identifier> &_iden,
-                    std::unique_ptr<Expression> &_idx)
+    IndexExpression(Identifier *_iden,
+                    Expression *_idx)
+        : iden(_iden)
+        , idx(_idx)
     {
         type = ExpressionType::INDEX;
-
-        iden = std::move(_iden);
-        idx = std::move(_idx);
     }
 
-    auto &getIden() { return iden->getLiteral(); }
-    auto getIndex() { return idx.get(); }
-
-    IndexExpression(const IndexExpression& _expr)
-    {
-        type = ExpressionType::INDEX;
-
-        iden = std::move(_expr.iden);
-        idx = std::move(_expr.idx);
-    }
+    auto getIden() { return iden->getLiteral(); }
+    auto getIdenSymbol() { return iden->getSymbol(); }
+    auto &getIdenToken() { return iden->getToken(); }
+    auto getIndex() { return idx; }
     
     std::string print(unsigned level) override
     {
         std::string prefix(level * 2, ' ');
 
         std::string ret = prefix + "{\n";
-        ret += (prefix + "  [ARRAY] " + iden->getLiteral() + "\n");
+        ret += (prefix + "  [ARRAY] " + std::string(iden->getLiteral()) + "\n");
         ret += (prefix + "  [INDEX]\n");
         ret += (prefix + "  {\n");
         if (idx->isExprLiteral())
@@ -376,21 +450,14 @@ class IndexExpression : public Expression
 class CallExpression : public Expression
 {
   protected:
-    std::shared_ptr<Identifier> def;
-    std::vector<std::shared_ptr<Expression>> args;
+    Identifier *def;
+    ArenaList<Expression*> args;
 
   public:
-    CallExpression(const CallExpression &_expr) 
-    {
-        def = std::move(_expr.def);
-        args = std::move(_expr.args);
-        type = ExpressionType::CALL;
-    }
-
-    CallExpression(std::unique_ptr<Identifier> &_tok, 
-        std::vector<std::shared_ptr<Expression>>_args) 
-        : def(std::move(_tok))
-        , args(std::move(_args))
+    CallExpression(Identifier *_def, 
+                   ArenaList<Expression*> _args) 
+        : def(_def)
+        , args(_args)
     {
         type = ExpressionType::CALL;
     }
@@ -401,7 +468,7 @@ class CallExpression : public Expression
         std::string prefix(level * 2, ' ');
 
         std::string ret = prefix + "{\n";
-        ret += (prefix + "  [CALL] " + def->getLiteral() + "\n");
+        ret += (prefix + "  [CALL] " + std::string(def->getLiteral()) + "\n");
         unsigned idx = 0;
         for (auto &arg : args)
         {
@@ -417,7 +484,9 @@ class CallExpression : public Expression
         return ret;
     }
 
-    auto &getCallFunc() { return def->getLiteral(); }
+    auto getCallFunc() { return def->getLiteral(); }
+    auto getCallFuncSymbol() { return def->getSymbol(); }
+    auto &getCallFuncToken() { return def->getToken(); }
     auto &getArgs() { return args; }
 };
 
@@ -463,29 +532,20 @@ class Statement
 class AssnStatement : public Statement
 {
   protected:
-    // using shared due to copy constructors
-    std::shared_ptr<Expression> iden;
-    std::shared_ptr<Expression> expr;
+    Expression *iden;
+    Expression *expr;
 
   public:
-    AssnStatement(std::unique_ptr<Expression> &_iden,
-                 std::unique_ptr<Expression> &_expr)
+    AssnStatement(Expression *_iden,
+                  Expression *_expr)
+        : iden(_iden)
+        , expr(_expr)
     {
         type = StatementType::ASSN_STATEMENT;
-
-        iden = std::move(_iden);
-        expr = std::move(_expr);
-    }
-    
-    AssnStatement(const AssnStatement &_statement)
-    {
-        iden = std::move(_statement.iden);
-        expr = std::move(_statement.expr);
-        type = _statement.type;
     }
 
-    auto getIden() { return iden.get(); }
-    auto getExpr() { return expr.get(); }
+    auto getIden() { return iden; }
+    auto getExpr() { return expr; }
 
     void printStatement() override;
 };
@@ -497,23 +557,21 @@ class FuncStatement : public Statement
     {
       protected:
         ValueType::Type type = ValueType::Type::MAX;
-        std::shared_ptr<Identifier> iden;
+        Identifier *iden;
 
       public:
-        Argument(std::string &_type, std::unique_ptr<Identifier> &_iden)
+        Argument(std::string_view _type, Identifier *_iden)
+            : iden(_iden)
         {
             type = ValueType::strToValueType(_type);
 
             assert(type != ValueType::Type::MAX);
-
-            iden = std::move(_iden);
         }
 
-        Argument(const Argument &arg)
-        {
-            type = arg.type;
-            iden = std::move(arg.iden);
-        }
+        Argument(ValueType::Type _type, Identifier *_iden)
+            : type(_type)
+            , iden(_iden)
+        {}
 
         std::string print()
         {
@@ -526,51 +584,42 @@ class FuncStatement : public Statement
             return ret;
         }
 
-        std::string &getLiteral() { return iden->getLiteral(); }
+        auto getLiteral() { return iden->getLiteral(); }
+        auto getSymbol() { return iden->getSymbol(); }
+        auto &getToken() { return iden->getToken(); }
         auto getArgType() { return type; }
     };
 
   protected:
-    // using shared due to copy constructors
     ValueType::Type func_type;
-    std::shared_ptr<Identifier> iden;
-    std::vector<Argument> args;
-    std::vector<std::shared_ptr<Statement>> codes;
+    Identifier *iden;
+    ArenaList<Argument> args;
+    ArenaList<Statement*> codes;
 
-    std::unordered_map<std::string, ValueType::Type> local_vars;
+    LocalVarTable local_vars;
 
   public:
     FuncStatement(ValueType::Type _type,
-                  std::unique_ptr<Identifier> &_iden,
-                  std::vector<Argument> &_args,
-                  std::vector<std::shared_ptr<Statement>> &_codes,
-                  std::unordered_map<std::string,ValueType::Type> &_local_vars)
+                  Identifier *_iden,
+                  ArenaList<Argument> _args,
+                  ArenaList<Statement*> _codes,
+                  LocalVarTable _local_vars)
+        : func_type(_type)
+        , iden(_iden)
+        , args(_args)
+        , codes(_codes)
+        , local_vars(_local_vars)
     {
         type = StatementType::FUNC_STATEMENT;
-
-        func_type = _type;
-        iden = std::move(_iden);
-        args = _args;
-        codes = std::move(_codes);
-        local_vars = _local_vars;
-    }
-    
-    FuncStatement(const FuncStatement &_statement)
-    {
-        type = _statement.type;
-
-        func_type = _statement.func_type;
-        iden = std::move(_statement.iden);
-        args = _statement.args;
-        codes = std::move(_statement.codes);
-        local_vars = _statement.local_vars;
     }
   
     auto getLocalVars() {return &local_vars; }
 
     auto getRetType() { return func_type; }
 
-    auto &getFuncName() { return iden->getLiteral(); }
+    auto getFuncName() { return iden->getLiteral(); }
+    auto getFuncSymbol() { return iden->getSymbol(); }
+    auto &getFuncToken() { return iden->getToken(); }
     auto &getFuncArgs() { return args; }
     auto &getFuncCodes() { return codes; }
 
@@ -580,22 +629,14 @@ class FuncStatement : public Statement
 class CallStatement : public Statement
 {
   protected:
-    std::shared_ptr<Expression> expr;
+    Expression *expr;
 
   public:
-    CallStatement(std::unique_ptr<Expression> &_expr,
+    CallStatement(Expression *_expr,
                   StatementType _type)
+        : expr(_expr)
     {
         type = _type;
-
-        expr = std::move(_expr);
-    }
-    
-    CallStatement(const CallStatement &_statement)
-    {
-        type = _statement.type;
-
-        expr = std::move(_statement.expr);
     }
     
     void printStatement() override
@@ -606,7 +647,7 @@ class CallStatement : public Statement
     CallExpression* getCallExpr()
     {
         CallExpression *call = 
-            static_cast<CallExpression*>(expr.get());
+            static_cast<CallExpression*>(expr);
         return call;
     }
 };
@@ -614,21 +655,15 @@ class CallStatement : public Statement
 class RetStatement : public Statement
 {
   protected:
-    std::shared_ptr<Expression> ret;
+    Expression *ret;
 
   public:
-    RetStatement(std::unique_ptr<Expression> &_ret) : ret(std::move(_ret))
+    RetStatement(Expression *_ret) : ret(_ret)
     {
         type = StatementType::RET_STATEMENT;
     }
 
-    RetStatement(const RetStatement &_statement)
-    {
-        type = _statement.type;
-        ret = std::move(_statement.ret);
-    }
-
-    auto getRetVal() { return ret.get(); }
+    auto getRetVal() { return ret; }
 
     void printStatement() override;
 };
@@ -638,59 +673,64 @@ class RetStatement : public Statement
 // cond_0 && cond_1
 class Condition
 {
-  protected:
-    ValueType::Type comp_type;
-
+  public:
     enum class OperatorType : int
     {
         EQ, NE, GT, GE, LT, LE, MAX
     };
+
+    static OperatorType strToOperatorType(std::string_view _opr)
+    {
+        if (_opr == "==") return OperatorType::EQ;
+        else if (_opr == "!=") return OperatorType::NE;
+        else if (_opr == ">") return OperatorType::GT;
+        else if (_opr == ">=") return OperatorType::GE;
+        else if (_opr == "<") return OperatorType::LT;
+        else if (_opr == "<=") return OperatorType::LE;
+        else return OperatorType::MAX;
+    }
+
+  protected:
+    ValueType::Type comp_type;
+
     OperatorType opr_type = OperatorType::MAX;
-    std::string opr_type_str;
 
-    std::shared_ptr<Expression> left;
-    std::shared_ptr<Expression> right;
+    Expression *left;
+    Expression *right;
 
   public:
-    Condition(std::unique_ptr<Expression> &_left,
-              std::unique_ptr<Expression> &_right,
-              std::string &_opr_type_str,
+    Condition(Expression *_left,
+              Expression *_right,
+              std::string_view _opr_type_str,
               ValueType::Type _comp_type)
+        : comp_type(_comp_type)
+        , left(_left)
+        , right(_right)
     {
-        left = std::move(_left);
-        right = std::move(_right);
-
-        if (_opr_type_str == "==")
-            opr_type = OperatorType::EQ;
-        else if (_opr_type_str == "!=")
-            opr_type = OperatorType::NE;
-        else if (_opr_type_str == ">")
-            opr_type = OperatorType::GT;
-        else if (_opr_type_str == ">=")
-            opr_type = OperatorType::GE;
-        else if (_opr_type_str == "<")
-            opr_type = OperatorType::LT;
-        else if (_opr_type_str == "<=")
-            opr_type = OperatorType::LE;
-        else
-            assert(false);
-
-        opr_type_str = _opr_type_str;
-
-        comp_type = _comp_type; 
+        opr_type = strToOperatorType(_opr_type_str);
+        assert(opr_type != OperatorType::MAX);
     }
 
-    Condition(const Condition& _cond)
-        : left(std::move(_cond.left))
-        , right(std::move(_cond.right))
-        , opr_type_str(_cond.opr_type_str)
-        , comp_type(_cond.comp_type)
+    Condition(Expression *_left,
+              Expression *_right,
+              OperatorType _opr_type,
+              ValueType::Type _comp_type)
+        : comp_type(_comp_type)
+        , opr_type(_opr_type)
+        , left(_left)
+        , right(_right)
     {}
 
     auto getType() { return comp_type; }
-    auto &getOpr() { return opr_type_str; }
-    auto getLeft() { return left.get(); }
-    auto getRight() { return right.get(); }
+    auto getOprType() { return opr_type; }
+    std::string_view getOpr()
+    {
+        static constexpr std::string_view names[] = 
+            {"==", "!=", ">", ">=", "<", "<="};
+        return names[static_cast<int>(opr_type)];
+    }
+    auto getLeft() { return left; }
+    auto getRight() { return right; }
 
     void printStatement();
 };
@@ -698,42 +738,30 @@ class Condition
 class IfStatement : public Statement
 {    
   protected:
-    std::shared_ptr<Condition> cond;
-    std::vector<std::shared_ptr<Statement>> taken_block;
-    std::vector<std::shared_ptr<Statement>> not_taken_block;
+    Condition *cond;
+    ArenaList<Statement*> taken_block;
+    ArenaList<Statement*> not_taken_block;
 
-    std::unordered_map<std::string, ValueType::Type> taken_local_vars;
-    std::unordered_map<std::string, ValueType::Type> not_taken_local_vars;
+    LocalVarTable taken_local_vars;
+    LocalVarTable not_taken_local_vars;
 
   public:
 
-    IfStatement(std::unique_ptr<Condition> &_cond,
-                std::vector<std::shared_ptr<Statement>> &_taken_block,
-                std::vector<std::shared_ptr<Statement>> &_not_taken_block,
-                std::unordered_map<std::string, 
-                                   ValueType::Type> &_taken_local_vars,
-                std::unordered_map<std::string, 
-                                   ValueType::Type> &_not_taken_local_vars)
+    IfStatement(Condition *_cond,
+                ArenaList<Statement*> _taken_block,
+                ArenaList<Statement*> _not_taken_block,
+                LocalVarTable _taken_local_vars,
+                LocalVarTable _not_taken_local_vars)
+        : cond(_cond)
+        , taken_block(_taken_block)
+        , not_taken_block(_not_taken_block)
+        , taken_local_vars(_taken_local_vars)
+        , not_taken_local_vars(_not_taken_local_vars)
     {
         type = StatementType::IF_STATEMENT;
-
-        cond = std::move(_cond);
-        taken_block = std::move(_taken_block);
-        not_taken_block = std::move(_not_taken_block);
-
-        taken_local_vars = _taken_local_vars;
-        not_taken_local_vars = _not_taken_local_vars;
     }
 
-    IfStatement(const IfStatement &_if)
-        : cond(std::move(_if.cond))
-        , taken_block(std::move(_if.taken_block))
-        , not_taken_block(std::move(_if.not_taken_block))
-        , taken_local_vars(_if.taken_local_vars)
-        , not_taken_local_vars(_if.not_taken_local_vars)
-    {}
-
-    auto getCond() { return cond.get(); }
+    auto getCond() { return cond; }
     auto &getTakenBlock() { return taken_block; }
     auto &getNotTakenBlock() { return not_taken_block; }
     auto getTakenBlockVars() { return &taken_local_vars; }
@@ -745,43 +773,32 @@ class IfStatement : public Statement
 class ForStatement : public Statement
 {    
   protected:
-    std::shared_ptr<Statement> start;
-    std::shared_ptr<Condition> end;
-    std::shared_ptr<Statement> step;
-    std::vector<std::shared_ptr<Statement>> block;
+    Statement *start;
+    Condition *end;
+    Statement *step;
+    ArenaList<Statement*> block;
 
-    std::unordered_map<std::string, ValueType::Type> block_local_vars;
+    LocalVarTable block_local_vars;
 
   public:
 
-    ForStatement(std::unique_ptr<Statement> &_start,
-                 std::unique_ptr<Condition> &_end,
-                 std::unique_ptr<Statement> &_step,
-                 std::vector<std::shared_ptr<Statement>> &_block,
-                 std::unordered_map<std::string, 
-                                    ValueType::Type> &_block_local_vars)
+    ForStatement(Statement *_start,
+                 Condition *_end,
+                 Statement *_step,
+                 ArenaList<Statement*> _block,
+                 LocalVarTable _block_local_vars)
+        : start(_start)
+        , end(_end)
+        , step(_step)
+        , block(_block)
+        , block_local_vars(_block_local_vars)
     {
         type = StatementType::FOR_STATEMENT;
-        
-        start = std::move(_start);
-        end = std::move(_end);
-        step = std::move(_step);
-        block = std::move(_block);
-
-        block_local_vars = _block_local_vars;
     }
 
-    ForStatement(const ForStatement &_for)
-        : start(std::move(_for.start))
-        , end(std::move(_for.end))
-        , step(std::move(_for.step))
-        , block(std::move(_for.block))
-        , block_local_vars(_for.block_local_vars)
-    {}
-
-    auto getStart() { return start.get(); }
-    auto getEnd() { return end.get(); }
-    auto getStep() { return step.get(); }
+    auto getStart() { return start; }
+    auto getEnd() { return end; }
+    auto getStep() { return step; }
     auto &getBlock() { return block; }
     auto getBlockVars() { return &block_local_vars; }
 
@@ -792,14 +809,56 @@ class ForStatement : public Statement
 class Program
 {
   protected:
-    std::vector<std::unique_ptr<Statement>> statements;
+    // Owns every node of the AST
+    Arena arena;
+    // Arenas filled by other parsers (threads) for this program
+    std::vector<Arena> adopted;
+
+    std::vector<Statement*> statements;
 
   public:
     Program() {}
 
-    void addStatement(std::unique_ptr<Statement> &_statement)
+    Program(Program&&) = default;
+    Program& operator=(Program&&) = default;
+
+    // Allocates an AST node in the program's arena
+    template<typename T, typename... Args>
+    T *make(Args&&... args)
     {
-        statements.push_back(std::move(_statement));
+        return arena.make<T>(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    ArenaList<T> makeList(const std::vector<T> &items)
+    {
+        return ArenaList<T>(arena, items);
+    }
+
+    LocalVarTable makeVarTable(const VarScopes &vars)
+    {
+        return LocalVarTable(arena, vars);
+    }
+
+    // Uninitialized list of n items, to be filled in place
+    template<typename T>
+    ArenaList<T> makeList(size_t n) { return ArenaList<T>(arena, n); }
+
+    void addStatement(Statement *_statement)
+    {
+        statements.push_back(_statement);
+    }
+
+    // Replaces statements [begin, end) with _statements. The replaced
+    // nodes stay in the arena until the program is rebuilt.
+    void replaceStatements(size_t begin, size_t end,
+                           std::vector<Statement*> &_statements)
+    {
+        statements.erase(statements.begin() + begin,
+                         statements.begin() + end);
+        statements.insert(statements.begin() + begin,
+                          _statements.begin(),
+                          _statements.end());
     }
 
     void printStatements()
@@ -808,8 +867,82 @@ class Program
     }
 
     auto& getStatements() { return statements; }
+
+    auto& getArena() { return arena; }
+
+    // Keeps the nodes allocated in another arena alive with the program
+    void adoptArena(Arena &&other) { adopted.push_back(std::move(other)); }
+};
+
+// Everything above is allocated in the arena
+static_assert(std::is_trivially_destructible_v<FuncStatement> &&
+              std::is_trivially_destructible_v<IfStatement> &&
+              std::is_trivially_destructible_v<ForStatement> &&
+              std::is_trivially_destructible_v<Condition>,
+              "AST nodes must not need destructors");
+
+/*
+ * Operator table of the expression parser (Pratt parsing)
+ *
+ * Every operator token has a binding power, higher binds tighter.
+ * Binary operators are left associative: the right operand is parsed
+ * with the operator's own power, so it stops at the next operator of
+ * the same level. Prefix operators are built as (0 <op> operand).
+ * Adding an operator is one row here (plus its ExpressionType).
+ * */
+struct OperatorInfo
+{
+    // binding power as a binary operator, 0 if it is not one
+    uint8_t infix_bp = 0;
+    // binding power as a prefix operator, 0 if it is not one
+    uint8_t prefix_bp = 0;
+    Expression::ExpressionType type = Expression::ExpressionType::ILLEGAL;
+};
+
+// Indexed by Token::TokenType
+constexpr std::array<OperatorInfo, 256> makeOperatorTable()
+{
+    using TokenType = Token::TokenType;
+    using ExprType = Expression::ExpressionType;
+
+    std::array<OperatorInfo, 256> table{};
+    auto row = [&table](TokenType tok, uint8_t infix_bp, uint8_t prefix_bp,
+                        ExprType type)
+    {
+        table[static_cast<uint8_t>(tok)] = {infix_bp, prefix_bp, type};
+    };
+
+    row(TokenType::TOKEN_PLUS, 10, 0, ExprType::PLUS);
+    row(TokenType::TOKEN_MINUS, 10, 30, ExprType::MINUS);
+    row(TokenType::TOKEN_ASTERISK, 20, 0, ExprType::ASTERISK);
+    row(TokenType::TOKEN_SLASH, 20, 0, ExprType::SLASH);
+    return table;
+}
+
+inline constexpr std::array<OperatorInfo, 256> operator_table =
+    makeOperatorTable();
+
+class Parser;
+
+// Every function signature is recorded before any body is parsed, so a
+// call may come before the callee's definition, whatever the options.
+struct ParseOptions
+{
+    // > 1 parses the function bodies on that many threads
+    unsigned threads = 1;
+    // directory of the binary AST cache, nullptr disables it
+    const char *ast_cache_dir = nullptr;
+    // Pipelined parsing: every function is handed to on_function as
+    // soon as it has been parsed (in source order, and only while there
+    // are no errors), and its nodes are freed when it returns. The
+    // program stays empty, so only one function is ever held in memory.
+    // Parsing is then serial and the AST cache is not used. (The tokens
+    // of the whole file are still held, for the signatures.)
+    std::function<void(Parser*, Statement*)> on_function;
 };
 
+class AstCache;
+
 /* Parser definition */
 class Parser
 {
@@ -817,8 +950,11 @@ class Parser
     Program program;
 
   protected:
+    // Copy of tokens->peek(0)
     Token cur_token;
-    Token next_token;    
+
+    // k tokens after cur_token
+    Token &peekToken(size_t k) { return tokens->peek(k); }
     
   /************* Section one - record local variable types ***************/
   protected:
@@ -828,34 +964,26 @@ class Parser
                ValueType::Type::MAX;
     }
 
-    // Track each local variable's type
-    // vector is needed because we need a way to distinguish vars inside
-    // if/else, for.
-    int entering_sub_block = 0;
-    std::vector<std::unordered_map<std::string,
-                                   ValueType::Type>*> local_vars_tracker;
+    // Track each local variable's type, a scope is needed for each
+    // block to distinguish vars inside if/else, for.
+    VarScopes var_scopes;
     // recordLocalVars v1 - record the arguments
     void recordLocalVars(FuncStatement::Argument &arg,
                          bool is_array = false,
                          bool is_ptr = false)
     {
-        auto arg_name = arg.getLiteral();
+        auto arg_sym = arg.getSymbol();
         auto arg_type = arg.getArgType();
         assert(arg_type != ValueType::Type::MAX);
 
-        auto &tracker = local_vars_tracker.back();
-
-        if (auto iter = tracker->find(arg_name);
-                iter != tracker->end())
+        if (var_scopes.inInnermostScope(arg_sym))
         {
-            std::cerr << "[Error] recordLocalVars: "
-                      << "duplicated variable definition."
-                      << std::endl;
-            exit(0);
+            error(arg.getToken(), "duplicate argument '" +
+                                  std::string(arg.getLiteral()) + "'");
         }
         else
         {
-            tracker->insert({arg_name, arg_type});
+            var_scopes.bind(arg_sym, arg_type);
         }
     }
     // recordLocalVars v2 - record local variables
@@ -881,22 +1009,17 @@ class Parser
         }
         
         // We should always allocate new variables to the most inner block
-        auto &tracker = local_vars_tracker.back();
-        tracker->insert({_tok.getLiteral(), var_type});
+        // (a redefinition has been reported already)
+        if (!var_scopes.inInnermostScope(_tok.getSymbol()))
+            var_scopes.bind(_tok.getSymbol(), var_type);
     }
     std::pair<bool,ValueType::Type> isVarAlreadyDefined(Token &_tok)
     {
-        for (int i = local_vars_tracker.size() - 1;
-                 i >= 0;
-                 i--)
-        {
-            auto &tracker = local_vars_tracker[i];
-            if (auto iter = tracker->find(_tok.getLiteral());
-                    iter != tracker->end())
-            {
-                return std::make_pair(true, iter->second);
-            }
-        }
+        if (!_tok.isTokenIden())
+            return std::make_pair(false, ValueType::Type::MAX);
+
+        if (auto type = var_scopes.find(_tok.getSymbol()); type != nullptr)
+            return std::make_pair(true, *type);
 
         return std::make_pair(false, ValueType::Type::MAX);
     }
@@ -908,6 +1031,12 @@ class Parser
         std::vector<ValueType::Type> arg_types;
 
         bool is_built_in = false;
+        bool is_defined = false;
+
+        // Increases along the program, with gaps so that functions can be
+        // added in between (see assignOrder()). Only kept once an edit
+        // split the source into pieces; 0 (before everything) otherwise.
+        uint64_t order = 0;
 
         FuncRecord() {}
 
@@ -915,18 +1044,31 @@ class Parser
             : ret_type(_record.ret_type)
             , arg_types(_record.arg_types)
             , is_built_in(_record.is_built_in)
+            , is_defined(_record.is_defined)
+            , order(_record.order)
         {}
+
+        FuncRecord &operator=(const FuncRecord&) = default;
     };
-    std::unordered_map<std::string,FuncRecord> func_def_tracker;
-    void recordDefs(std::string &_def,
+    // Indexed by the function's symbol
+    std::vector<FuncRecord> func_def_tracker;
+    FuncRecord *findFuncDef(Symbol _def)
+    {
+        if (_def >= func_def_tracker.size() ||
+            !func_def_tracker[_def].is_defined)
+            return nullptr;
+
+        return &func_def_tracker[_def];
+    }
+    void recordDefs(Symbol _def,
                     ValueType::Type _type,
                     std::vector<FuncStatement::Argument> &_args)
     {
-        auto iter = func_def_tracker.find(_def);
-        assert(iter == func_def_tracker.end() && "duplicated def");
+        assert(findFuncDef(_def) == nullptr && "duplicated def");
 
         FuncRecord record;
         record.ret_type = _type;
+        record.is_defined = true;
 
         auto &arg_types = record.arg_types;
         for (auto &arg : _args)
@@ -934,15 +1076,19 @@ class Parser
             arg_types.push_back(arg.getArgType());
         }
         
+        if (_def >= func_def_tracker.size())
+            func_def_tracker.resize(_def + 1);
         func_def_tracker[_def] = record;
     }
     
-    std::pair<bool,bool> isFuncDef(std::string &_def)
+    std::pair<bool,bool> isFuncDef(Token &_tok)
     {
-        if (auto iter = func_def_tracker.find(_def);
-                iter != func_def_tracker.end())
+        FuncRecord *record = 
+            _tok.isTokenIden() ? findFuncDef(_tok.getSymbol()) : nullptr;
+
+        if (record != nullptr)
         {
-            return std::make_pair(true, iter->second.is_built_in);
+            return std::make_pair(true, record->is_built_in);
         }
         else
         {
@@ -951,19 +1097,19 @@ class Parser
     }
 
   public:
-    auto& getFuncArgTypes(std::string &func_name)
+    auto& getFuncArgTypes(Symbol func_sym)
     {
-        auto iter = func_def_tracker.find(func_name);
-        assert(iter != func_def_tracker.end());
-        return iter->second.arg_types;
+        FuncRecord *record = findFuncDef(func_sym);
+        assert(record != nullptr);
+        return record->arg_types;
     }
 
-    auto &getFuncRetType(std::string &_def)
+    auto &getFuncRetType(Symbol _def)
     {
-        auto iter = func_def_tracker.find(_def);
-        assert(iter != func_def_tracker.end());
+        FuncRecord *record = findFuncDef(_def);
+        assert(record != nullptr);
 
-        return iter->second.ret_type;
+        return record->ret_type;
     }
 
   protected:
@@ -982,10 +1128,8 @@ class Parser
         if (tok_type == cur_expr_type)
             return;
 
-        std::cerr << "[Error] Token type of <" << _tok.getLiteral()
-                  << "> inconsistent within expression" << std::endl;
-        std::cerr << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
+        error(_tok, "type of '" + std::string(_tok.getLiteral()) +
+                    "' is inconsistent within the expression");
     }
 
     ValueType::Type getTokenType(Token &_tok, bool is_index_or_deref = false)
@@ -996,25 +1140,18 @@ class Parser
         else tok_type = ValueType::Type::MAX;
 
         // If the token is a variable, we need extract its recorded type
-        for (int i = local_vars_tracker.size() - 1;
-                 i >= 0;
-                 i--)
+        if (auto [is_var, var_type] = isVarAlreadyDefined(_tok); is_var)
         {
-            auto &tracker = local_vars_tracker[i];
-            if (auto iter = tracker->find(_tok.getLiteral());
-                    iter != tracker->end())
-            {
-                tok_type = iter->second;
-                break;
-            }
+            tok_type = var_type;
         }
         
         // If the token is function name, we need to extract its
         // recorded type.
-        if (auto iter = func_def_tracker.find(_tok.getLiteral());
-                iter != func_def_tracker.end())
+        if (FuncRecord *record = _tok.isTokenIden() ? 
+                                 findFuncDef(_tok.getSymbol()) : nullptr;
+                record != nullptr)
         {
-            tok_type = iter->second.ret_type;
+            tok_type = record->ret_type;
         }
         
         if (is_index_or_deref)
@@ -1030,34 +1167,189 @@ class Parser
 
   protected:
     std::unique_ptr<Lexer> lexer;
+    std::unique_ptr<TokenStream> tokens;
+
+    // Interner shared by every lexer of this parser
+    StringInterner *strings;
+
+  /******************* Error reporting and recovery **********************/
+  protected:
+    Diagnostics diags;
+
+    // Set by a syntax error until the parser has skipped to a point where
+    // it can go on (see syncStatement/syncFunction). Parse functions
+    // return nullptr while it is set, and further errors are dropped.
+    bool panic = false;
+
+    // Number of '{' before cur_token that are not closed yet
+    unsigned brace_depth = 0;
+
+    // Lines before the text held by the current lexer (an edited region
+    // starts in the middle of the file)
+    uint32_t line_offset = 0;
+
+    // Records an error, the parse goes on
+    void error(const Token &_tok, std::string msg);
+    // Records an error and enters panic mode
+    void syntaxError(const Token &_tok, std::string msg);
+    // Syntax error unless cur_token is of the given type, what names it
+    bool expect(Token::TokenType type, const char *what)
+    {
+        if (cur_token.type == type) return true;
+
+        syntaxError(cur_token, std::string("expected ") + what +
+                               ", got " + describe(cur_token));
+        return false;
+    }
+    std::string describe(Token &_tok)
+    {
+        if (_tok.isTokenEOF()) return "end of file";
+        return "'" + std::string(_tok.getLiteral()) + "'";
+    }
+
+    // A type, a name and '(' only ever start a function definition
+    bool isFuncStart()
+    {
+        return isTokenTypeKeyword(cur_token) &&
+               peekToken(1).isTokenIden() &&
+               peekToken(2).isTokenLP();
+    }
+
+    void syncStatement(unsigned depth);
+    void syncFunction(const char *func_start);
+
+    // Prints all the errors and exits if there are any
+    void reportErrors();
 
   public:
-    Parser(const char* fn); 
+    Parser(const char* fn, const LexOptions &lex_opts = LexOptions(),
+           const ParseOptions &parse_opts = ParseOptions());
+    ~Parser();
 
     void printStatements() { program.printStatements(); }
 
     auto &getProgram() { return program; }
 
+    auto &getDiagnostics() { return diags; }
+
+  /************* Section three - incremental reparsing *******************/
+  protected:
+    // First token of every function parsed from the current lexer
+    std::vector<const char*> func_starts;
+
+    // The source split at top-level functions, built by the first edit.
+    // pieces[0] is the text before the first function, pieces[i + 1] is
+    // statement i from its first token up to the next function.
+    std::vector<std::string> pieces;
+    // Offset in the whole source just past pieces[i], and the number of
+    // lines before that offset, so an edit finds its pieces by binary
+    // search
+    std::vector<size_t> piece_ends;
+    std::vector<uint32_t> piece_end_lines;
+
+    // Callers of every function, indexed by the callee's symbol: caller
+    // symbol -> number of calls. Built the first time an edit changes or
+    // removes a signature, kept up to date from then on.
+    std::vector<std::unordered_map<Symbol, uint32_t>> func_callers;
+    bool have_callers = false;
+
+    // Order keys are this far apart when (re)numbered
+    static constexpr uint64_t ORDER_GAP = uint64_t(1) << 32;
+
+    // Lexers replaced by edits, untouched functions and the interner
+    // still point into their buffers.
+    std::vector<std::unique_ptr<Lexer>> retired_lexers;
+    size_t retired_bytes = 0;
+
+    void buildPieces();
+    void rebuild(std::string &&text);
+
+    uint64_t &funcOrder(size_t stmt);
+    void assignOrder(size_t begin, size_t end);
+    size_t findStatement(Symbol func_sym);
+
+    void buildCallers();
+    void countCalls(Statement *func, int delta);
+
+    size_t reparsePieces(size_t first, size_t last, std::string &&region,
+                         std::vector<Symbol> &changed);
+
+  public:
+    // Replaces length bytes at offset with text. Only the functions the
+    // edit touches are relexed and reparsed, the rest of the AST and
+    // their func_def_tracker records are kept, unless the edit changes
+    // or removes a signature: the functions calling it are then parsed
+    // again too. Returns the number of functions parsed.
+    size_t applyEdit(size_t offset, size_t length, std::string_view text);
+
+    // Source text including all edits
+    std::string getSource();
+
+  /************* Section four - parallel parsing *************************/
+  protected:
+    unsigned parse_threads = 1;
+
+    // A worker parses function bodies for owner, see
+    // parseFunctionsParallel()
+    Parser *owner = nullptr;
+    explicit Parser(Parser *_owner);
+
+    // Tokens [begin, end) of one function in the whole token array
+    struct FuncRange
+    {
+        size_t begin;
+        size_t end;
+    };
+    // Functions handed to a worker at a time
+    static constexpr size_t FUNCS_PER_TASK = 16;
+
+    bool splitFunctions(std::vector<Token> &toks,
+                        std::vector<FuncRange> &ranges);
+    std::vector<Statement*> parseFunctionsParallel();
+    Statement *parseFunctionAt(const Token *begin, const Token *end);
+
+  /************* Section five - pipelining *******************************/
   protected:
+    // See ParseOptions::on_function
+    std::function<void(Parser*, Statement*)> on_function;
+
+  /************* Section six - AST cache *********************************/
+  protected:
+    // The loaded cache, the interner may point into it
+    std::unique_ptr<AstCache> ast_cache;
+
+    // Builds the program from the cached AST of this exact source
+    // instead of parsing it, false if there is none
+    bool loadAst(const std::string &fn, uint64_t content_hash);
+    // Writes the cache for the next run
+    void storeAst(const std::string &fn, uint64_t content_hash);
+
+  protected:
+    void recordBuiltins();
+
     void parseProgram();
+    std::vector<Statement*> parseFunctions();
+    Statement *parseFunction();
     void advanceTokens();
 
-    void parseStatement(std::string&,
-                        std::vector<std::shared_ptr<Statement>>&);
-    std::unique_ptr<Statement> parseAssnStatement();
+    void parseBlock(Symbol, std::vector<Statement*>&);
+    void parseStatement(Symbol, std::vector<Statement*>&);
+    Statement *parseAssnStatement();
 
-    std::unique_ptr<Condition> parseCondition();
-    std::unique_ptr<Statement> parseIfStatement(std::string&);
-    std::unique_ptr<Statement> parseForStatement(std::string&);
+    Condition *parseCondition();
+    Statement *parseIfStatement(Symbol);
+    Statement *parseForStatement(Symbol);
 
-    std::unique_ptr<Expression> parseExpression();
-    std::unique_ptr<Expression> parseTerm(
-        std::unique_ptr<Expression> pending_left = nullptr);
-    std::unique_ptr<Expression> parseFactor();
+    // Pratt parser driven by operator_table: parses operators that bind
+    // tighter than min_bp
+    Expression *parseExpression(unsigned min_bp = 0);
+    Expression *parseInfix(Expression *left, unsigned min_bp);
+    Expression *parsePrefix();
+    Expression *parseOperand();
 
-    std::unique_ptr<Expression> parseArrayExpr();
-    std::unique_ptr<Expression> parseIndex();
-    std::unique_ptr<Expression> parseCall();
+    Expression *parseArrayExpr();
+    Expression *parseIndex();
+    Expression *parseCall();
 };
 }
 #endif
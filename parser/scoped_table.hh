@@ -0,0 +1,104 @@
+#ifndef __SCOPED_TABLE_HH__
+#define __SCOPED_TABLE_HH__
+
+#include "lexer/interner.hh"
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * ScopedTable - symbol table for nested blocks.
+ *
+ * Every symbol has a stack of bindings, the innermost one on top, so a
+ * lookup is a single array access however deep the block nesting is
+ * (symbols are small dense integers, see StringInterner). The bindings
+ * of all open scopes live in one vector in the order they were made;
+ * each remembers the binding it shadows. Leaving a scope pops the
+ * bindings made since it was entered and puts the shadowed ones back.
+ * That tail of the vector is the undo log of the scope.
+ * */
+template<typename V>
+class ScopedTable
+{
+  public:
+    using Symbol = StringInterner::Symbol;
+
+    struct Binding
+    {
+        Symbol sym;
+        // binding of sym this one shadows, NONE if there is none
+        uint32_t shadowed;
+        V value;
+    };
+
+  protected:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Innermost binding of every symbol, NONE if unbound
+    std::vector<uint32_t> heads;
+    // Bindings of all open scopes, innermost scope last
+    std::vector<Binding> bindings;
+    // bindings.size() when each open scope was entered
+    std::vector<uint32_t> scope_starts;
+
+  public:
+    void enterScope() { scope_starts.push_back(bindings.size()); }
+
+    void exitScope()
+    {
+        assert(!scope_starts.empty());
+        uint32_t start = scope_starts.back();
+        scope_starts.pop_back();
+
+        while (bindings.size() > start)
+        {
+            auto &binding = bindings.back();
+            heads[binding.sym] = binding.shadowed;
+            bindings.pop_back();
+        }
+    }
+
+    // Binds sym in the innermost scope, shadowing any outer binding
+    void bind(Symbol sym, const V &value)
+    {
+        assert(!scope_starts.empty());
+        if (sym >= heads.size()) heads.resize(sym + 1, NONE);
+
+        bindings.push_back(Binding{sym, heads[sym], value});
+        heads[sym] = bindings.size() - 1;
+    }
+
+    // Innermost binding of sym, nullptr if it has none
+    V *find(Symbol sym)
+    {
+        if (sym >= heads.size() || heads[sym] == NONE) return nullptr;
+        return &bindings[heads[sym]].value;
+    }
+
+    // Whether sym is bound in the innermost scope itself
+    bool inInnermostScope(Symbol sym) const
+    {
+        return !scope_starts.empty() &&
+               sym < heads.size() && heads[sym] != NONE &&
+               heads[sym] >= scope_starts.back();
+    }
+
+    // Bindings made in the innermost scope
+    const Binding *scopeBegin() const
+    {
+        assert(!scope_starts.empty());
+        return bindings.data() + scope_starts.back();
+    }
+    const Binding *scopeEnd() const
+    {
+        return bindings.data() + bindings.size();
+    }
+
+    size_t depth() const { return scope_starts.size(); }
+};
+}
+
+#endif